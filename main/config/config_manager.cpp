@@ -1,12 +1,13 @@
 #include "config_manager.h"
 #include "app_events.h"
 #include "logging/logging_tags.h"
+#include "util/cores.h"
 #include "util/default_event.h"
 #include "util/filesystem/file_info.h"
 #include "util/filesystem/filesystem.h"
 #include "util/hash/hash.h"
 #include "util/helper.h"
-#include "util/psram_allocator.h"
+#include "util/json_arena.h"
 #include <esp_log.h>
 #include <filesystem>
 
@@ -31,6 +32,21 @@ void config::begin()
 
     nvs_storage.begin("nvs", "config");
 
+    {
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        auto data = std::make_shared<config_data>();
+        data->host_name = nvs_storage.get(host_name_key, default_host_name);
+        data->web_user_credentials = credentials(nvs_storage.get(web_login_username_key, default_user_id_and_password),
+                                                 nvs_storage.get(web_login_password_key, default_user_id_and_password));
+        data->wifi_credentials =
+            credentials(nvs_storage.get(ssid_key, std::string_view()), nvs_storage.get(ssid_password_key, std::string_view()));
+        persisted_ = data;
+        snapshot_.store(std::move(data));
+    }
+
+    CHECK_THROW_ESP(writer_task_.spawn_pinned("config_task", 3 * 1024, tskIDLE_PRIORITY + 1, esp32::other_task_core));
+    instance_reboot_event_.subscribe();
+
     ESP_LOGI(CONFIG_TAG, "Hostname:%s", get_host_name().c_str());
     ESP_LOGI(CONFIG_TAG, "Web user name:%s", get_web_user_credentials().get_user_name().c_str());
     ESP_LOGI(CONFIG_TAG, "Web user password:%s", get_web_user_credentials().get_password().c_str());
@@ -38,16 +54,86 @@ void config::begin()
     ESP_LOGI(CONFIG_TAG, "Wifi ssid password:%s", get_wifi_credentials().get_password().c_str());
 }
 
-void config::save()
+void config::transaction::commit()
+{
+    // readers keep their old snapshot until they load again
+    config_.snapshot_.store(std::move(data_));
+    lock_.unlock();
+    config_.request_write();
+}
+
+void config::request_write()
 {
+    const auto handle = writer_task_.handle();
+    if (handle)
+    {
+        xTaskNotifyGive(handle);
+    }
+}
+
+// only keys that differ from the last write, one commit for all
+void config::write()
+{
+    const auto data = get_snapshot();
+    if (data == persisted_)
+    {
+        return;
+    }
+
     ESP_LOGI(CONFIG_TAG, "config save");
+    if (data->host_name != persisted_->host_name)
+    {
+        nvs_storage.save(host_name_key, data->host_name);
+    }
+    if (data->web_user_credentials.get_user_name() != persisted_->web_user_credentials.get_user_name())
+    {
+        nvs_storage.save(web_login_username_key, data->web_user_credentials.get_user_name());
+    }
+    if (data->web_user_credentials.get_password() != persisted_->web_user_credentials.get_password())
+    {
+        nvs_storage.save(web_login_password_key, data->web_user_credentials.get_password());
+    }
+    if (data->wifi_credentials.get_user_name() != persisted_->wifi_credentials.get_user_name())
+    {
+        nvs_storage.save(ssid_key, data->wifi_credentials.get_user_name());
+    }
+    if (data->wifi_credentials.get_password() != persisted_->wifi_credentials.get_password())
+    {
+        nvs_storage.save(ssid_password_key, data->wifi_credentials.get_password());
+    }
     nvs_storage.commit();
+    persisted_ = data;
+
     CHECK_THROW_ESP(esp32::event_post(APP_COMMON_EVENT, CONFIG_CHANGE));
 }
 
+void config::writer_task_ftn()
+{
+    ESP_LOGI(CONFIG_TAG, "Config task started on core:%d", xPortGetCoreID());
+    do
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // wait until changes stop, so a burst of transactions is written once
+        while (!flush_requested_ && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(write_debounce_ms)))
+        {
+        }
+        flush_requested_ = false;
+
+        try
+        {
+            write();
+        }
+        catch (const std::exception &ex)
+        {
+            ESP_LOGE(CONFIG_TAG, "Config write failed:%s", ex.what());
+        }
+    } while (true);
+}
+
 std::string config::get_all_config_as_json()
 {
-    BasicJsonDocument<esp32::psram::json_allocator> json_document(2048);
+    esp32::json_arena_document json_document;
 
     json_document[(HostNameId)] = get_host_name();
     const auto web_cred = get_web_user_credentials();
@@ -66,39 +152,15 @@ std::string config::get_all_config_as_json()
 
 std::string config::get_host_name()
 {
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    return nvs_storage.get(host_name_key, default_host_name);
-}
-
-void config::set_host_name(const std::string &host_name)
-{
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    nvs_storage.save(host_name_key, host_name);
+    return get_snapshot()->host_name;
 }
 
 credentials config::get_web_user_credentials()
 {
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    return credentials(nvs_storage.get(web_login_username_key, default_user_id_and_password),
-                       nvs_storage.get(web_login_password_key, default_user_id_and_password));
-}
-
-void config::set_web_user_credentials(const credentials &web_user_credentials)
-{
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    nvs_storage.save(web_login_username_key, web_user_credentials.get_user_name());
-    nvs_storage.save(web_login_password_key, web_user_credentials.get_password());
-}
-
-void config::set_wifi_credentials(const credentials &wifi_credentials)
-{
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    nvs_storage.save(ssid_key, wifi_credentials.get_user_name());
-    nvs_storage.save(ssid_password_key, wifi_credentials.get_password());
+    return get_snapshot()->web_user_credentials;
 }
 
 credentials config::get_wifi_credentials()
 {
-    std::lock_guard<esp32::semaphore> lock(data_mutex_);
-    return credentials(nvs_storage.get(ssid_key, std::string_view()), nvs_storage.get(ssid_password_key, std::string_view()));
+    return get_snapshot()->wifi_credentials;
 }
@@ -1,38 +1,120 @@
 #pragma once
 
+#include "app_events.h"
 #include "credentials.h"
 #include "preferences.h"
 #include "util/arduino_json_helper.h"
+#include "util/default_event.h"
 #include "util/noncopyable.h"
 #include "util/semaphore_lockable.h"
 #include "util/singleton.h"
+#include "util/task_wrapper.h"
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <vector>
 
+// all settings, never changed once published
+struct config_data
+{
+    std::string host_name;
+    credentials web_user_credentials;
+    credentials wifi_credentials;
+};
+
+/**
+ * Settings are loaded from NVS once in begin() and served from an immutable in memory snapshot.
+ * Changes are made through a transaction, which publishes a modified copy.
+ * A background task writes the changed keys to NVS in one batch once changes stop for write_debounce_ms,
+ * and posts CONFIG_CHANGE after the commit.
+ */
 class config : public esp32::singleton<config>
 {
   public:
+    using snapshot_t = std::shared_ptr<const config_data>;
+
+    /**
+     * Collects changes to a copy of the settings, writers are serialized for the lifetime of the transaction.
+     * Changes are dropped unless commit() is called.
+     */
+    class transaction final : esp32::noncopyable
+    {
+      public:
+        void set_host_name(const std::string &host_name)
+        {
+            data_->host_name = host_name;
+        }
+
+        void set_web_user_credentials(const credentials &web_user_credentials)
+        {
+            data_->web_user_credentials = web_user_credentials;
+        }
+
+        void set_wifi_credentials(const credentials &wifi_credentials)
+        {
+            data_->wifi_credentials = wifi_credentials;
+        }
+
+        // publishes the changes and schedules the NVS write
+        void commit();
+
+      private:
+        transaction(config &config) : config_(config), lock_(config.data_mutex_), data_(std::make_shared<config_data>(*config.get_snapshot()))
+        {
+        }
+
+        friend class config;
+
+        config &config_;
+        std::unique_lock<esp32::semaphore> lock_;
+        std::shared_ptr<config_data> data_;
+    };
+
     void begin();
-    void save();
+
+    transaction begin_transaction()
+    {
+        return transaction(*this);
+    }
+
+    snapshot_t get_snapshot() const
+    {
+        return snapshot_.load();
+    }
 
     std::string get_all_config_as_json();
 
     std::string get_host_name();
-    void set_host_name(const std::string &host_name);
-
     credentials get_web_user_credentials();
-    void set_web_user_credentials(const credentials &web_user_credentials);
-
-    void set_wifi_credentials(const credentials &wifi_credentials);
     credentials get_wifi_credentials();
 
   private:
-    config() = default;
+    config() : writer_task_([this] { writer_task_ftn(); })
+    {
+    }
 
     friend class esp32::singleton<config>;
 
+    static constexpr uint32_t write_debounce_ms = 500;
+
+    // serializes writers, readers only load snapshot_
     mutable esp32::semaphore data_mutex_;
+    // only used by begin() and then the writer task
     preferences nvs_storage;
+    std::atomic<snapshot_t> snapshot_{std::make_shared<const config_data>()};
+    // last snapshot written to NVS
+    snapshot_t persisted_;
+    std::atomic_bool flush_requested_{false};
+    esp32::task writer_task_;
+
+    // write pending changes right away, reboot happens after a delay
+    esp32::default_event_subscriber instance_reboot_event_{APP_COMMON_EVENT, APP_EVENT_REBOOT, [this](esp_event_base_t, int32_t, void *) {
+                                                               flush_requested_ = true;
+                                                               request_write();
+                                                           }};
+
+    void request_write();
+    void write();
+    void writer_task_ftn();
 };
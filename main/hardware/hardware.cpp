@@ -5,27 +5,41 @@
 #include "homekit/homekit_integration.h"
 #include "logging/logging_tags.h"
 #include "util/cores.h"
+#include "util/deadline_scheduler.h"
 #include "util/exceptions.h"
 #include "util/helper.h"
 #include "util/misc.h"
+#include <driver/gpio.h>
 #include <driver/i2c.h>
 #include <esp_log.h>
 
-template <class T> bool hardware::read_sensor_if_time(T &sensor, uint64_t &last_read)
+namespace
 {
-    bool updated = false;
-    const auto now = esp32::millis();
-    if (now - last_read >= sensor_history::sensor_interval)
-    {
-        for (auto &&value : sensor.read())
-        {
-            set_sensor_value(std::get<0>(value), std::get<1>(value));
-            updated = true;
-        }
-        last_read = now;
-    }
-    return updated;
+// Magnus formula coefficients over water, good to ~0.1C between -40C and 50C
+constexpr float magnus_b = 17.62f;
+constexpr float magnus_c = 243.12f;
+constexpr float magnus_saturation_hpa = 6.112f;
+// molar mass of water / universal gas constant, g*K/J with pressure in hPa
+constexpr float water_vapor_constant = 216.7f;
+
+// actual vapor pressure in hPa, shared by dew point and absolute humidity
+float vapor_pressure(float temperature, float humidity)
+{
+    return magnus_saturation_hpa * expf(magnus_b * temperature / (magnus_c + temperature)) * humidity / 100;
+}
+
+float dew_point(float vapor_pressure)
+{
+    const float gamma = logf(vapor_pressure / magnus_saturation_hpa);
+    return magnus_c * gamma / (magnus_b - gamma);
+}
+
+// g/m³
+float absolute_humidity(float temperature, float vapor_pressure)
+{
+    return water_vapor_constant * vapor_pressure / (273.15f + temperature);
 }
+} // namespace
 
 float hardware::get_sensor_value(sensor_id_index index) const
 {
@@ -33,14 +47,30 @@ float hardware::get_sensor_value(sensor_id_index index) const
     return sensor.get_value();
 }
 
-sensor_history::sensor_history_snapshot hardware::get_sensor_detail_info(sensor_id_index index)
+sensor_history::sensor_history_snapshot hardware::get_sensor_detail_info(sensor_id_index index, uint32_t since, uint16_t points)
 {
-    return (*sensors_history_)[static_cast<size_t>(index)].get_snapshot(sensor_history::reads_per_minute);
+    auto &&history = (*sensors_history_)[static_cast<size_t>(index)];
+    if (points)
+    {
+        return history.get_downsampled_snapshot(points, since);
+    }
+    return history.get_snapshot(sensor_history::reads_per_minute, since);
 }
 
 void hardware::begin()
 {
     CHECK_THROW_ESP(i2cdev_init());
+    for (size_t i = 0; i < total_sensors; i++)
+    {
+        const auto &definition = sensor_definitions[i];
+        (*sensors_history_)[i].set_range(definition.get_min_value(), definition.get_max_value());
+    }
+
+    // restore before the sensor task adds the first value
+    history_store_.restore();
+    history_store_.begin();
+    instance_reboot_event_.subscribe();
+
     sensor_refresh_task_.spawn_pinned("sensor_task", 4 * 1024, esp32::task::default_priority, esp32::hardware_core);
 }
 
@@ -48,18 +78,20 @@ void hardware::set_sensor_value(sensor_id_index index, float value)
 {
     bool changed;
     const auto i = static_cast<size_t>(index);
+
+    // invalid value is recorded as a gap
+    (*sensors_history_)[i].add_value(value);
+
     if (!std::isnan(value))
     {
-        (*sensors_history_)[i].add_value(value);
-        changed = sensors_[i].set_value(value);
-        ESP_LOGI(HARDWARE_TAG, "Updated for sensor:%.*s Value:%g", get_sensor_name(index).size(), get_sensor_name(index).data(),
+        changed = sensors_[i].set_value(value, get_sensor_definition(index).get_publish_policy());
+        ESP_LOGD(HARDWARE_TAG, "Updated for sensor:%.*s Value:%g", get_sensor_name(index).size(), get_sensor_name(index).data(),
                  sensors_[i].get_value());
     }
     else
     {
         ESP_LOGW(HARDWARE_TAG, "Got an invalid value for sensor:%.*s", get_sensor_name(index).size(), get_sensor_name(index).data());
-        (*sensors_history_)[i].clear();
-        changed = sensors_[i].set_invalid_value();
+        changed = sensors_[i].set_invalid_value(get_sensor_definition(index).get_publish_policy());
     }
 
     if (changed)
@@ -79,29 +111,49 @@ void hardware::sensor_task_ftn()
         // light green on start
         led_.set_color(0, 64, 0);
 
-        TickType_t initial_delay = 0;
-
-        initial_delay = std::max<TickType_t>(initial_delay, sht3x_sensor1_.get_initial_delay());
-        initial_delay = std::max<TickType_t>(initial_delay, sht3x_sensor2_.get_initial_delay());
-
-        sht3x_sensor1_.init(I2C_NUM_0, GPIO_NUM_42, GPIO_NUM_2);
-        sht3x_sensor2_.init(I2C_NUM_1, GPIO_NUM_38, GPIO_NUM_39);
-
         const uart_init_config ld2450_init_config{UART_NUM_0, GPIO_NUM_47, GPIO_NUM_21, 4 * 1024, 256000};
         ld2450_.init(ld2450_init_config);
 
-        // Wait until all sensors are ready
-        vTaskDelay(initial_delay);
+        const gpio_config_t fan_relay_config{
+            .pin_bit_mask = BIT64(fan_relay_gpio),
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        CHECK_THROW_ESP(gpio_config(&fan_relay_config));
+        CHECK_THROW_ESP(gpio_set_level(fan_relay_gpio, 0));
 
         // clear on no error
         led_.clear();
 
-        ESP_LOGI(HARDWARE_TAG, "Sensors initialized");
-        do
+        // I2C sensors init on their first step and keep retrying on their own
+        esp32::deadline_scheduler scheduler;
+        std::array<esp32::deadline_scheduler::job_id_t, std::tuple_size_v<decltype(i2c_sensors_)>> i2c_jobs;
+        for (size_t i = 0; i < i2c_sensors_.size(); i++)
         {
-            read_sht3x_sensors();
-            vTaskDelay(pdMS_TO_TICKS(sensor_history::sensor_interval / 50));
+            i2c_jobs[i] = scheduler.add_adaptive([&sensor = i2c_sensors_[i]] { return sensor.step(); });
+        }
 
+        do
+        {
+            auto wait = scheduler.run_due();
+
+            // the period changes in the callback of the second SHT3x, after the first one was already
+            // scheduled with the old period, restart both together so the reads stay paired
+            if (sht3x_period_changed_)
+            {
+                sht3x_period_changed_ = false;
+                const auto period = sht3x_sampling_.period();
+                for (auto &&job : i2c_jobs)
+                {
+                    scheduler.reschedule(job, period);
+                }
+                wait = scheduler.run_due();
+            }
+
+            // sleep until the next read is due
+            vTaskDelay(std::max<TickType_t>(1, pdMS_TO_TICKS(wait)));
         } while (true);
     }
     catch (const std::exception &ex)
@@ -114,15 +166,64 @@ void hardware::sensor_task_ftn()
     vTaskDelete(NULL);
 }
 
-void hardware::read_sht3x_sensors()
+void hardware::set_sensor_values(const i2c_sensor_device &device, std::span<const float> values)
+{
+    const auto channels = device.get_channels();
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        set_sensor_value(channels[i], values[i]);
+    }
+}
+
+void hardware::set_sht3x_values(uint8_t sensor, const i2c_sensor_device &device, std::span<const float> values)
+{
+    set_sensor_values(device, values);
+
+    // averages once both have a read of the same cycle
+    sht3x_fetched_ |= 1 << sensor;
+    if (sht3x_fetched_ == 0b11)
+    {
+        sht3x_fetched_ = 0;
+        update_sht3x_averages();
+    }
+}
+
+void hardware::update_sht3x_averages()
 {
-    const auto changed1 = read_sensor_if_time(sht3x_sensor1_, sht3x_sensor_last_read1_);
-    const auto changed2 = read_sensor_if_time(sht3x_sensor2_, sht3x_sensor_last_read2_);
+    const auto humidity = (get_sensor_value(sensor_id_index::humidity1) + get_sensor_value(sensor_id_index::humidity2)) / 2;
+    const auto temperature = (get_sensor_value(sensor_id_index::temperature1) + get_sensor_value(sensor_id_index::temperature2)) / 2;
+    set_sensor_value(sensor_id_index::humidity, esp32::round_with_precision(humidity, 0.1f));
+    set_sensor_value(sensor_id_index::temperature, esp32::round_with_precision(temperature, 0.1f));
+
+    // derived from the same averaged sample, NAN propagates if a read failed
+    const auto pressure = vapor_pressure(temperature, humidity);
+    set_sensor_value(sensor_id_index::dew_point, esp32::round_with_precision(dew_point(pressure), 0.1f));
+    set_sensor_value(sensor_id_index::absolute_humidity, esp32::round_with_precision(absolute_humidity(temperature, pressure), 0.1f));
+
+    // both runners are already scheduled with the old period, the sensor task restarts them on a change
+    const auto was_fast = sht3x_sampling_.is_fast();
+    const auto period = sht3x_sampling_.update(humidity, esp32::millis64());
+    if (was_fast != sht3x_sampling_.is_fast())
+    {
+        ESP_LOGI(HARDWARE_TAG, "SHT3x sampling every %lu ms", period);
+        sht3x_period_changed_ = true;
+    }
 
-    if (changed1 || changed2)
+    update_shower_state(humidity);
+}
+
+void hardware::update_shower_state(float humidity)
+{
+    const auto baseline = get_sensor_history(sensor_id_index::humidity).get_quantile(0.5f).value_or(NAN);
+    if (!shower_detector_.update(humidity, baseline, ld2450_.is_occupied(), esp32::millis64()))
     {
-        // update average
-        const auto value = get_sensor_value(sensor_id_index::humidity1) + get_sensor_value(sensor_id_index::humidity2);
-        set_sensor_value(sensor_id_index::humidity, esp32::round_with_precision(value / 2.0, 1));
+        return;
     }
+
+    // relay is switched right here, so the fan does not wait for any automation
+    const bool active = shower_detector_.is_active();
+    CHECK_THROW_ESP(gpio_set_level(fan_relay_gpio, active ? 1 : 0));
+
+    ESP_LOGI(HARDWARE_TAG, "Shower %s, humidity:%g baseline:%g rate:%g/min", active ? "started" : "stopped", humidity, baseline,
+             shower_detector_.get_rate());
 }
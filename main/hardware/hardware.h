@@ -1,10 +1,16 @@
 #pragma once
 
+#include "app_events.h"
+#include "hardware/history_store.h"
 #include "hardware/inbuild_led.h"
+#include "hardware/sensors/adaptive_sampling.h"
+#include "hardware/sensors/i2c_sensor_runner.h"
 #include "hardware/sensors/ld2540/ld2450.h"
 #include "hardware/sensors/sensor.h"
 #include "hardware/sensors/sht3x_sensor_device.h"
+#include "hardware/shower_detector.h"
 #include "ui/ui_interface.h"
+#include "util/default_event.h"
 #include "util/psram_allocator.h"
 #include "util/singleton.h"
 #include <i2cdev.h>
@@ -23,7 +29,7 @@ class hardware final : public esp32::singleton<hardware>
     }
 
     float get_sensor_value(sensor_id_index index) const;
-    sensor_history::sensor_history_snapshot get_sensor_detail_info(sensor_id_index index);
+    sensor_history::sensor_history_snapshot get_sensor_detail_info(sensor_id_index index, uint32_t since = 0, uint16_t points = 0);
 
     const sensor_history &get_sensor_history(sensor_id_index index) const
     {
@@ -44,16 +50,57 @@ class hardware final : public esp32::singleton<hardware>
     std::array<sensor_value, total_sensors> sensors_;
     std::unique_ptr<std::array<sensor_history, total_sensors>, esp32::psram::deleter> sensors_history_ =
         esp32::psram::make_unique<std::array<sensor_history, total_sensors>>();
+    history_store history_store_{*sensors_history_};
+    // save history before reboot, reboot happens after a delay
+    esp32::default_event_subscriber instance_reboot_event_{APP_COMMON_EVENT, APP_EVENT_REBOOT,
+                                                           [this](esp_event_base_t, int32_t, void *) { history_store_.request_checkpoint(); }};
 
     esp32::task sensor_refresh_task_;
 
+    // measure twice a second, a new result is always ready for the fastest 1s reads
+    static constexpr sht3x_mode_t sht3x_mode = SHT3X_PERIODIC_2MPS;
+
+    // read every 30s while humidity is flat, every 1s once it changes faster than 1%/min(shower)
+    adaptive_sampling sht3x_sampling_{{.slow_ms = 30 * 1000,
+                                       .fast_ms = 1000,
+                                       .enter_rate = 1.0f,
+                                       .exit_rate = 0.5f,
+                                       .hold_ms = 2 * 60 * 1000,
+                                       .rate_window_ms = 25 * 1000}};
+
     // SHT31 - Sensor 1
-    sht3x_sensor_device sht3x_sensor1_{sensor_id_index::humidity1};
-    uint64_t sht3x_sensor_last_read1_ = 0;
+    sht3x_sensor_device sht3x_sensor1_{"SHT31-1", {I2C_NUM_0, GPIO_NUM_42, GPIO_NUM_2}, sensor_id_index::humidity1,
+                                       sensor_id_index::temperature1, sht3x_mode};
 
     // SHT31 - Sensor 2
-    sht3x_sensor_device sht3x_sensor2_{sensor_id_index::humidity2};
-    uint64_t sht3x_sensor_last_read2_ = 0;
+    sht3x_sensor_device sht3x_sensor2_{"SHT31-2", {I2C_NUM_1, GPIO_NUM_38, GPIO_NUM_39}, sensor_id_index::humidity2,
+                                       sensor_id_index::temperature2, sht3x_mode};
+
+    // bit per SHT3x fetched since the averages were last updated
+    uint8_t sht3x_fetched_{0};
+    // set when the sampling period changed, the runners are rescheduled outside of their callbacks
+    bool sht3x_period_changed_{false};
+
+    // all I2C sensors, each runs independently from the sensor task
+    // a device without derived values uses set_sensor_values as callback
+    std::array<i2c_sensor_runner, 2> i2c_sensors_{
+        i2c_sensor_runner{sht3x_sensor1_, [this] { return sht3x_sampling_.period(); },
+                          [this](const i2c_sensor_device &device, std::span<const float> values) { set_sht3x_values(0, device, values); }},
+        i2c_sensor_runner{sht3x_sensor2_, [this] { return sht3x_sampling_.period(); },
+                          [this](const i2c_sensor_device &device, std::span<const float> values) { set_sht3x_values(1, device, values); }},
+    };
+
+    // fan relay, high while a shower is detected
+    static constexpr gpio_num_t fan_relay_gpio = GPIO_NUM_4;
+
+    // humidity rising faster than 3%/min and 5% above the median of the history window, with someone in the room
+    shower_detector shower_detector_{{.rate_time_constant_ms = 20 * 1000,
+                                      .start_rate = 3.0f,
+                                      .start_rise = 5.0f,
+                                      .stop_rise = 3.0f,
+                                      .min_on_ms = 5 * 60 * 1000,
+                                      .max_on_ms = 60 * 60 * 1000,
+                                      .occupancy_hold_ms = 10 * 60 * 1000}};
 
     inbuild_led led_;
 
@@ -61,8 +108,9 @@ class hardware final : public esp32::singleton<hardware>
 
     void set_sensor_value(sensor_id_index index, float value);
 
-    void read_sht3x_sensors();
+    void set_sensor_values(const i2c_sensor_device &device, std::span<const float> values);
+    void set_sht3x_values(uint8_t sensor, const i2c_sensor_device &device, std::span<const float> values);
+    void update_sht3x_averages();
+    void update_shower_state(float humidity);
     void sensor_task_ftn();
-
-    template <class T> bool read_sensor_if_time(T &sensor, uint64_t &last_read);
 };
@@ -0,0 +1,236 @@
+#include "hardware/history_store.h"
+
+#include "logging/logging_tags.h"
+#include "util/cores.h"
+#include "util/exceptions.h"
+#include <algorithm>
+#include <cstring>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+namespace
+{
+constexpr size_t align_to_sector(size_t size)
+{
+    return (size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+}
+} // namespace
+
+uint32_t history_store::header_crc(const record_header &header)
+{
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), offsetof(record_header, header_crc));
+}
+
+bool history_store::restore()
+{
+    static_assert(partition_size % align_to_sector(max_record_size) == 0, "history partition should be a multiple of the record size");
+
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (!partition_)
+    {
+        ESP_LOGW(HARDWARE_TAG, "No %s partition, history is not persisted", partition_label);
+        return false;
+    }
+
+    if (partition_->size < align_to_sector(max_record_size))
+    {
+        ESP_LOGE(HARDWARE_TAG, "History partition too small:%lu", partition_->size);
+        partition_ = nullptr;
+        return false;
+    }
+
+    buffer_.resize(max_record_size);
+
+    // only record headers are read here, at most one per sector
+    struct candidate
+    {
+        size_t offset;
+        record_header header;
+    };
+    std::vector<candidate> candidates;
+
+    for (size_t offset = 0; offset + sizeof(record_header) <= partition_->size; offset += SPI_FLASH_SEC_SIZE)
+    {
+        record_header header;
+        if (esp_partition_read(partition_, offset, &header, sizeof(header)) != ESP_OK)
+        {
+            continue;
+        }
+
+        if ((header.magic == record_magic) && (header.header_crc == header_crc(header)))
+        {
+            candidates.push_back({offset, header});
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const candidate &a, const candidate &b) { return a.header.generation > b.header.generation; });
+
+    if (!candidates.empty())
+    {
+        // continue after the newest record even if it turns out to be unreadable
+        const auto &newest = candidates.front();
+        next_offset_ = align_to_sector(newest.offset + sizeof(record_header) + newest.header.data_size);
+        next_generation_ = newest.header.generation + 1;
+    }
+
+    for (auto &&candidate : candidates)
+    {
+        if (read_record(candidate.offset, candidate.header))
+        {
+            ESP_LOGI(HARDWARE_TAG, "Restored history from checkpoint:%lu at offset:%u", candidate.header.generation, candidate.offset);
+            return true;
+        }
+        ESP_LOGW(HARDWARE_TAG, "Skipping invalid history checkpoint:%lu at offset:%u", candidate.header.generation, candidate.offset);
+    }
+
+    ESP_LOGI(HARDWARE_TAG, "No history checkpoint found");
+    return false;
+}
+
+bool history_store::read_record(size_t offset, const record_header &header)
+{
+    // older layout or sensor list, not usable
+    if ((header.version != record_version) || (header.sensor_count != total_sensors) || (header.data_size > buffer_.size()) ||
+        (header.data_size < total_sensors * sizeof(sensor_header)))
+    {
+        return false;
+    }
+
+    if (esp_partition_read(partition_, offset + sizeof(record_header), buffer_.data(), header.data_size) != ESP_OK)
+    {
+        return false;
+    }
+
+    if (esp_rom_crc32_le(0, buffer_.data(), header.data_size) != header.data_crc)
+    {
+        return false;
+    }
+
+    std::array<sensor_header, total_sensors> sensor_headers;
+    std::memcpy(sensor_headers.data(), buffer_.data(), sizeof(sensor_headers));
+
+    size_t expected_size = sizeof(sensor_headers);
+    for (auto &&sensor_header : sensor_headers)
+    {
+        // there can not be more minutes than up to the one of the last entry
+        if ((sensor_header.count > max_groups) ||
+            (sensor_header.count && (!sensor_header.sequence || (sensor_header.count > (sensor_header.sequence - 1) / group_size + 1))))
+        {
+            return false;
+        }
+        expected_size += sensor_header.count * sizeof(sensor_history::value_t);
+    }
+
+    if (expected_size != header.data_size)
+    {
+        return false;
+    }
+
+    // each minute mean is repeated for its entries, up to the entry before sequence
+    std::vector<sensor_history::value_t, esp32::psram::allocator<sensor_history::value_t>> entries(sensor_history::count);
+    auto means = reinterpret_cast<const sensor_history::value_t *>(buffer_.data() + sizeof(sensor_headers));
+    for (size_t i = 0; i < total_sensors; i++)
+    {
+        const auto &sensor_header = sensor_headers[i];
+        size_t count = 0;
+        if (sensor_header.count)
+        {
+            const uint32_t first_group = (sensor_header.sequence - 1) / group_size + 1 - sensor_header.count;
+            const uint32_t oldest = sensor_header.sequence - std::min<uint32_t>(sensor_header.sequence, entries.size());
+            const uint32_t begin = std::max<uint32_t>(first_group * group_size, oldest);
+            for (uint32_t sequence = begin; sequence < sensor_header.sequence; sequence++)
+            {
+                entries[count++] = means[sequence / group_size - first_group];
+            }
+        }
+
+        histories_[i].restore({entries.data(), count}, sensor_header.sequence);
+        means += sensor_header.count;
+    }
+    return true;
+}
+
+void history_store::begin()
+{
+    if (partition_)
+    {
+        CHECK_THROW_ESP(writer_task_.spawn_pinned("history_task", 4 * 1024, tskIDLE_PRIORITY + 1, esp32::hardware_core));
+    }
+}
+
+// on reboot this races the reboot delay and the write may be cut short, that only loses
+// the new record because its header is written last
+void history_store::request_checkpoint()
+{
+    const auto handle = writer_task_.handle();
+    if (handle)
+    {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void history_store::checkpoint()
+{
+    // copy out under the history locks, flash is only touched after that
+    std::array<sensor_header, total_sensors> sensor_headers{};
+    auto values = reinterpret_cast<sensor_history::value_t *>(buffer_.data() + sizeof(record_header) + sizeof(sensor_headers));
+    uint64_t sequences = 0;
+    for (size_t i = 0; i < total_sensors; i++)
+    {
+        sensor_headers[i].count = histories_[i].copy_grouped_values({values, max_groups}, group_size, sensor_headers[i].sequence);
+        values += sensor_headers[i].count;
+        sequences += sensor_headers[i].sequence;
+    }
+
+    if (sequences == last_checkpoint_sequences_)
+    {
+        return;
+    }
+
+    const auto data = buffer_.data() + sizeof(record_header);
+    std::memcpy(data, sensor_headers.data(), sizeof(sensor_headers));
+
+    record_header header{};
+    header.magic = record_magic;
+    header.version = record_version;
+    header.sensor_count = total_sensors;
+    header.generation = next_generation_;
+    header.data_size = reinterpret_cast<uint8_t *>(values) - data;
+    header.data_crc = esp_rom_crc32_le(0, data, header.data_size);
+    header.header_crc = header_crc(header);
+
+    const auto record_size = align_to_sector(sizeof(record_header) + header.data_size);
+    if (next_offset_ + record_size > partition_->size)
+    {
+        next_offset_ = 0;
+    }
+
+    // data first and header last, a partial record has no valid header
+    CHECK_THROW_ESP(esp_partition_erase_range(partition_, next_offset_, record_size));
+    CHECK_THROW_ESP(esp_partition_write(partition_, next_offset_ + sizeof(record_header), data, header.data_size));
+    CHECK_THROW_ESP(esp_partition_write(partition_, next_offset_, &header, sizeof(header)));
+
+    ESP_LOGD(HARDWARE_TAG, "Wrote history checkpoint:%lu at offset:%u size:%lu", header.generation, next_offset_, header.data_size);
+
+    next_offset_ += record_size;
+    next_generation_++;
+    last_checkpoint_sequences_ = sequences;
+}
+
+void history_store::writer_task_ftn()
+{
+    ESP_LOGI(HARDWARE_TAG, "History task started on core:%d", xPortGetCoreID());
+    do
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(checkpoint_interval_ms));
+        try
+        {
+            checkpoint();
+        }
+        catch (const std::exception &ex)
+        {
+            ESP_LOGE(HARDWARE_TAG, "History checkpoint failed:%s", ex.what());
+        }
+    } while (true);
+}
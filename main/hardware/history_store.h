@@ -0,0 +1,95 @@
+#pragma once
+
+#include "hardware/sensors/sensor.h"
+#include "util/noncopyable.h"
+#include "util/psram_allocator.h"
+#include "util/task_wrapper.h"
+#include <array>
+#include <esp_partition.h>
+#include <vector>
+
+/**
+ * Checkpoints sensor histories to the "history" data partition.
+ * Each checkpoint is written as one record starting at a sector boundary, after the previous one,
+ * wrapping around at the end of partition so that erases are spread over all sectors.
+ * The record header is written last, so a record interrupted by a reset is never picked up.
+ * Histories are stored as per minute means, which keeps a record small enough for a few of them
+ * to fit in the flash left after the app partitions. A restored minute fills all of its entries.
+ */
+class history_store final : esp32::noncopyable
+{
+  public:
+    using histories_t = std::array<sensor_history, total_sensors>;
+
+    history_store(histories_t &histories) : histories_(histories), writer_task_([this] { writer_task_ftn(); })
+    {
+    }
+
+    /**
+     * Restores histories from the newest valid checkpoint, must be called before values are added.
+     * Returns true if a checkpoint was restored.
+     */
+    bool restore();
+
+    /**
+     * Starts the background task that writes a checkpoint every checkpoint_interval_ms.
+     */
+    void begin();
+
+    /**
+     * Wakes the background task to write a checkpoint now, for example before reboot.
+     */
+    void request_checkpoint();
+
+  private:
+    static constexpr char partition_label[] = "history";
+    static constexpr uint32_t checkpoint_interval_ms = 30 * 60 * 1000;
+    static constexpr uint32_t record_magic = 0x54534948; // HIST
+    static constexpr uint16_t record_version = 2;
+
+    struct record_header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t sensor_count;
+        uint32_t generation;
+        uint32_t data_size;
+        uint32_t data_crc;
+        uint32_t reserved[2];
+        // crc of the fields above
+        uint32_t header_crc;
+    };
+
+    // record data is total_sensors sensor_header followed by the minute means of each sensor in the same order
+    struct sensor_header
+    {
+        // sequence of the next entry
+        uint32_t sequence;
+        // number of means, the last one is the minute of sequence - 1
+        uint16_t count;
+        uint16_t reserved;
+    };
+
+    static constexpr size_t group_size = sensor_history::reads_per_minute;
+    // the oldest and newest minutes can be partial
+    static constexpr size_t max_groups = sensor_history::count / group_size + 1;
+    static constexpr size_t max_record_size =
+        sizeof(record_header) + total_sensors * (sizeof(sensor_header) + max_groups * sizeof(sensor_history::value_t));
+    // size of the history partition in partitions.csv
+    static constexpr size_t partition_size = 0xC000;
+
+    histories_t &histories_;
+    const esp_partition_t *partition_{nullptr};
+    // offset of the next record, always sector aligned
+    size_t next_offset_{0};
+    uint32_t next_generation_{1};
+    // sum of sequences at the last checkpoint, used to skip writes when nothing changed
+    uint64_t last_checkpoint_sequences_{0};
+    std::vector<uint8_t, esp32::psram::allocator<uint8_t>> buffer_;
+    esp32::task writer_task_;
+
+    static uint32_t header_crc(const record_header &header);
+    bool read_record(size_t offset, const record_header &header);
+    void checkpoint();
+    void writer_task_ftn();
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cmath>
+#include <stdint.h>
+
+/**
+ * Picks the sampling period from the rate of change of a value.
+ * Samples slowly while the value is flat, switches to fast sampling once the rate crosses enter_rate
+ * and goes back only after the rate stayed below exit_rate for hold_ms.
+ * The rate is only measured over at least rate_window_ms, so sensor noise between fast samples
+ * does not count as change.
+ */
+class adaptive_sampling
+{
+  public:
+    struct policy
+    {
+        uint32_t slow_ms;
+        uint32_t fast_ms;
+        // per minute
+        float enter_rate;
+        float exit_rate;
+        uint32_t hold_ms;
+        uint32_t rate_window_ms;
+    };
+
+    constexpr adaptive_sampling(const policy &policy) : policy_(policy)
+    {
+    }
+
+    /**
+     * Updates with a sample taken at now(ms), returns the period until the next sample.
+     */
+    uint32_t update(float value, uint64_t now)
+    {
+        if (std::isnan(value))
+        {
+            return period();
+        }
+
+        if (std::isnan(reference_value_))
+        {
+            reference_value_ = value;
+            reference_time_ = now;
+            return period();
+        }
+
+        const auto elapsed = now - reference_time_;
+        if (elapsed < policy_.rate_window_ms)
+        {
+            return period();
+        }
+
+        const float rate = std::abs(value - reference_value_) * 60000 / elapsed;
+        reference_value_ = value;
+        reference_time_ = now;
+
+        if (rate >= policy_.enter_rate)
+        {
+            fast_ = true;
+            last_active_time_ = now;
+        }
+        else if (rate >= policy_.exit_rate)
+        {
+            last_active_time_ = now;
+        }
+        else if (fast_ && (now - last_active_time_ >= policy_.hold_ms))
+        {
+            fast_ = false;
+        }
+        return period();
+    }
+
+    bool is_fast() const
+    {
+        return fast_;
+    }
+
+    uint32_t period() const
+    {
+        return fast_ ? policy_.fast_ms : policy_.slow_ms;
+    }
+
+  private:
+    const policy policy_;
+    bool fast_{false};
+    float reference_value_{NAN};
+    uint64_t reference_time_{};
+    uint64_t last_active_time_{};
+};
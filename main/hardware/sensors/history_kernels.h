@@ -0,0 +1,315 @@
+#pragma once
+
+#include "sdkconfig.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && defined(__XTENSA__)
+#define HISTORY_KERNELS_PIE 1
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#define HISTORY_KERNELS_PIE 0
+#endif
+
+/**
+ * Aggregation kernels over contiguous runs of history entries(int16 fixed point, gap_value marks a missing read).
+ * Loops are branch free, gaps are masked instead of skipped, so that the compiler can unroll and vectorize them.
+ * Results can be carried from one call to the next to cover the two segments of a ring buffer.
+ * On the ESP32-S3, sum and min_max run the 16 byte aligned middle of a run on the PIE vector unit(8 lanes),
+ * the unaligned head and tail use the portable loops. The PIE has no float lanes, so the LTTB kernels stay portable.
+ */
+namespace history_kernels
+{
+using value_t = int16_t;
+constexpr value_t gap_value = std::numeric_limits<value_t>::min();
+
+struct sum_result
+{
+    int32_t sum;
+    uint32_t count;
+};
+
+// min > max if there was no value
+struct min_max_result
+{
+    value_t min{std::numeric_limits<value_t>::max()};
+    value_t max{std::numeric_limits<value_t>::min()};
+};
+
+// sums of x(position) and y(value) of valid entries, for the LTTB bucket average
+struct point_sum_result
+{
+    float x;
+    int32_t y;
+    uint32_t count;
+};
+
+// LTTB best entry so far, area < 0 if none
+struct triangle_result
+{
+    float area{-1};
+    size_t index{};
+};
+
+// running group for grouped_mean, filled counts gaps as well
+struct group_state
+{
+    sum_result sum;
+    size_t filled;
+};
+
+inline value_t mean(const sum_result &result)
+{
+    return result.count ? static_cast<value_t>(std::lround(static_cast<float>(result.sum) / result.count)) : gap_value;
+}
+
+namespace portable
+{
+/**
+ * Sum and count of the non gap values.
+ */
+inline sum_result sum(std::span<const value_t> values, sum_result result = {})
+{
+    int32_t sum = 0;
+    uint32_t count = 0;
+    for (auto value : values)
+    {
+        const bool valid = value != gap_value;
+        sum += valid ? value : 0;
+        count += valid;
+    }
+    return {result.sum + sum, result.count + count};
+}
+
+/**
+ * Min and max of the non gap values.
+ */
+inline min_max_result min_max(std::span<const value_t> values, min_max_result result = {})
+{
+    value_t min = result.min;
+    value_t max = result.max;
+    for (auto value : values)
+    {
+        // gap is the lowest value, so it never wins max and maps to the highest value for min
+        const value_t gap_mask = -static_cast<value_t>(value == gap_value);
+        min = std::min<value_t>(min, value ^ gap_mask);
+        max = std::max<value_t>(max, value);
+    }
+    return {min, max};
+}
+} // namespace portable
+
+#if HISTORY_KERNELS_PIE
+namespace pie
+{
+// runs shorter than this are not worth the scheduler suspension
+constexpr size_t min_values = 64;
+constexpr size_t lanes = 8;
+
+// the Q registers and ACCX are not saved on a task switch, so no other task may run on this core meanwhile
+class scheduler_guard
+{
+  public:
+    scheduler_guard()
+    {
+        vTaskSuspendAll();
+    }
+    ~scheduler_guard()
+    {
+        xTaskResumeAll();
+    }
+};
+
+struct split_result
+{
+    std::span<const value_t> head;
+    std::span<const value_t> body;
+    std::span<const value_t> tail;
+};
+
+// body is 16 byte aligned and a multiple of lanes, vector loads ignore the low address bits
+inline split_result split(std::span<const value_t> values)
+{
+    const auto misaligned = reinterpret_cast<uintptr_t>(values.data()) & 15;
+    const size_t head = std::min(values.size(), ((16 - misaligned) & 15) / sizeof(value_t));
+    const size_t body = (values.size() - head) / lanes * lanes;
+    return {values.first(head), values.subspan(head, body), values.subspan(head + body)};
+}
+
+inline sum_result sum(std::span<const value_t> values, sum_result result)
+{
+    static const value_t gap = gap_value;
+    static const value_t one = 1;
+    const value_t *data = values.data();
+    size_t blocks = values.size() / lanes;
+    int32_t sum;
+    int32_t count;
+
+    // q0 values, q1 valid mask, q4 valid count per lane, q5 gap in all lanes, q6 one in all lanes
+    asm volatile("ee.zero.accx\n"
+                 "ee.zero.q q4\n"
+                 "ee.vldbc.16 q5, %[gap]\n"
+                 "ee.vldbc.16 q6, %[one]\n"
+                 "1:\n"
+                 "ee.vld.128.ip q0, %[data], 16\n"
+                 "ee.vcmp.eq.s16 q1, q0, q5\n"
+                 "ee.notq q1, q1\n"
+                 "ee.andq q0, q0, q1\n"
+                 "ee.andq q1, q1, q6\n"
+                 "ee.vmulas.s16.accx q0, q6\n"
+                 "ee.vadds.s16 q4, q4, q1\n"
+                 "addi %[blocks], %[blocks], -1\n"
+                 "bnez %[blocks], 1b\n"
+                 "movi %[sum], 0\n"
+                 "ee.srs.accx %[sum], %[sum], 0\n"
+                 "ee.zero.accx\n"
+                 "ee.vmulas.s16.accx q4, q6\n"
+                 "movi %[count], 0\n"
+                 "ee.srs.accx %[count], %[count], 0\n"
+                 : [data] "+r"(data), [blocks] "+r"(blocks), [sum] "=&r"(sum), [count] "=&r"(count)
+                 : [gap] "r"(&gap), [one] "r"(&one)
+                 : "memory");
+
+    return {result.sum + sum, result.count + static_cast<uint32_t>(count)};
+}
+
+inline min_max_result min_max(std::span<const value_t> values, min_max_result result)
+{
+    static const value_t gap = gap_value;
+    static const value_t highest = std::numeric_limits<value_t>::max();
+    alignas(16) value_t lanes_out[2 * lanes];
+    const value_t *data = values.data();
+    value_t *out = lanes_out;
+    size_t blocks = values.size() / lanes;
+
+    // q0 values, q1 gap mask, q2 min per lane, q3 max per lane, q5 gap in all lanes
+    asm volatile("ee.vldbc.16 q5, %[gap]\n"
+                 "ee.vldbc.16 q2, %[highest]\n"
+                 "ee.vldbc.16 q3, %[gap]\n"
+                 "1:\n"
+                 "ee.vld.128.ip q0, %[data], 16\n"
+                 "ee.vcmp.eq.s16 q1, q0, q5\n"
+                 "ee.xorq q1, q0, q1\n"
+                 "ee.vmin.s16 q2, q2, q1\n"
+                 "ee.vmax.s16 q3, q3, q0\n"
+                 "addi %[blocks], %[blocks], -1\n"
+                 "bnez %[blocks], 1b\n"
+                 "ee.vst.128.ip q2, %[out], 16\n"
+                 "ee.vst.128.ip q3, %[out], 16\n"
+                 : [data] "+r"(data), [blocks] "+r"(blocks), [out] "+r"(out)
+                 : [gap] "r"(&gap), [highest] "r"(&highest)
+                 : "memory");
+
+    for (size_t i = 0; i < lanes; i++)
+    {
+        result.min = std::min(result.min, lanes_out[i]);
+        result.max = std::max(result.max, lanes_out[lanes + i]);
+    }
+    return result;
+}
+} // namespace pie
+#endif
+
+/**
+ * Sum and count of the non gap values.
+ */
+inline sum_result sum(std::span<const value_t> values, sum_result result = {})
+{
+#if HISTORY_KERNELS_PIE
+    if (values.size() >= pie::min_values)
+    {
+        const auto split = pie::split(values);
+        result = portable::sum(split.head, result);
+        {
+            pie::scheduler_guard guard;
+            result = pie::sum(split.body, result);
+        }
+        return portable::sum(split.tail, result);
+    }
+#endif
+    return portable::sum(values, result);
+}
+
+/**
+ * Min and max of the non gap values.
+ */
+inline min_max_result min_max(std::span<const value_t> values, min_max_result result = {})
+{
+#if HISTORY_KERNELS_PIE
+    if (values.size() >= pie::min_values)
+    {
+        const auto split = pie::split(values);
+        result = portable::min_max(split.head, result);
+        {
+            pie::scheduler_guard guard;
+            result = pie::min_max(split.body, result);
+        }
+        return portable::min_max(split.tail, result);
+    }
+#endif
+    return portable::min_max(values, result);
+}
+
+/**
+ * Calls out(mean) for every completed group of group_size entries, an all gap group has a gap mean.
+ * state carries an incomplete group into the next call, start with state.filled set to
+ * the number of entries of the first group that are not part of values.
+ */
+template <class F> void grouped_mean(std::span<const value_t> values, size_t group_size, group_state &state, F &&out)
+{
+    while (!values.empty())
+    {
+        const auto size = std::min(group_size - state.filled, values.size());
+        state.sum = sum(values.first(size), state.sum);
+        state.filled += size;
+        values = values.subspan(size);
+        if (state.filled == group_size)
+        {
+            out(mean(state.sum));
+            state = {};
+        }
+    }
+}
+
+/**
+ * Sums positions and values of non gap entries, x is the position of values[0].
+ */
+inline point_sum_result point_sum(std::span<const value_t> values, float x, point_sum_result result = {})
+{
+    for (auto value : values)
+    {
+        const bool valid = value != gap_value;
+        result.x += valid ? x : 0;
+        result.y += valid ? value : 0;
+        result.count += valid;
+        x++;
+    }
+    return result;
+}
+
+/**
+ * LTTB step: finds the entry forming the largest triangle with points a and c, x is the position of values[0].
+ */
+inline triangle_result largest_triangle(std::span<const value_t> values, float x, float ax, float ay, float cx, float cy,
+                                        triangle_result result = {})
+{
+    for (auto value : values)
+    {
+        // twice the triangle area, constant factor does not matter
+        const float area = (value != gap_value) ? std::abs((ax - cx) * (value - ay) - (ax - x) * (cy - ay)) : -1;
+        if (area > result.area)
+        {
+            result.area = area;
+            result.index = static_cast<size_t>(x);
+        }
+        x++;
+    }
+    return result;
+}
+
+} // namespace history_kernels
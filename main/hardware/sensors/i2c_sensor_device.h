@@ -0,0 +1,43 @@
+#pragma once
+
+#include "hardware/sensors/sensor_id.h"
+#include "util/noncopyable.h"
+#include <driver/gpio.h>
+#include <driver/i2c.h>
+#include <esp_err.h>
+#include <span>
+#include <stdint.h>
+
+struct i2c_bus
+{
+    i2c_port_t port;
+    gpio_num_t sda_gpio;
+    gpio_num_t scl_gpio;
+};
+
+/**
+ * A sensor on an I2C bus, measured in two phases so that the bus is never held while the sensor converts.
+ * Devices on the same bus share it through the i2cdev port lock, which is taken per transaction only.
+ * Calls come from the sensor task only.
+ */
+class i2c_sensor_device : esp32::noncopyable
+{
+  public:
+    static constexpr size_t max_channels = 4;
+
+    virtual ~i2c_sensor_device() = default;
+
+    virtual const char *get_name() const = 0;
+
+    // sensors filled by fetch(), in the same order
+    virtual std::span<const sensor_id_index> get_channels() const = 0;
+
+    // on success, ready_after_ms is the time before the first start()
+    virtual esp_err_t init(uint32_t &ready_after_ms) = 0;
+
+    // triggers a measurement, on success ready_after_ms is the time before fetch(), 0 if a result is already there
+    virtual esp_err_t start(uint32_t &ready_after_ms) = 0;
+
+    // reads the measurement into values, one per channel
+    virtual esp_err_t fetch(std::span<float> values) = 0;
+};
@@ -0,0 +1,104 @@
+#include "hardware/sensors/i2c_sensor_runner.h"
+
+#include "logging/logging_tags.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <esp_log.h>
+
+uint32_t i2c_sensor_runner::step()
+{
+    switch (state_)
+    {
+    case state::uninitialized:
+        return init();
+    case state::idle:
+        return start();
+    case state::measuring:
+        return fetch();
+    }
+    return retry_init_ms;
+}
+
+uint32_t i2c_sensor_runner::init()
+{
+    uint32_t ready_after_ms = 0;
+    const auto err = device_.init(ready_after_ms);
+    if (err != ESP_OK)
+    {
+        // back off up to a minute for a missing device
+        const auto retry_ms = std::min(retry_init_ms << std::min<uint8_t>(init_failures_, 6), max_retry_init_ms);
+        init_failures_ = std::min<uint8_t>(init_failures_ + 1, UINT8_MAX);
+        ESP_LOGE(HARDWARE_TAG, "Failed to init %s with error:%s, retry in %lu ms", device_.get_name(), esp_err_to_name(err), retry_ms);
+        publish_invalid();
+        return retry_ms;
+    }
+
+    ESP_LOGI(HARDWARE_TAG, "Initialized %s", device_.get_name());
+    init_failures_ = 0;
+    failures_ = 0;
+    state_ = state::idle;
+    return std::max<uint32_t>(ready_after_ms, 1);
+}
+
+uint32_t i2c_sensor_runner::start()
+{
+    const auto err = device_.start(ready_after_ms_);
+    if (err != ESP_OK)
+    {
+        ready_after_ms_ = 0;
+        return failed("start", err);
+    }
+
+    state_ = state::measuring;
+    if (ready_after_ms_ == 0)
+    {
+        return fetch();
+    }
+    return ready_after_ms_;
+}
+
+uint32_t i2c_sensor_runner::fetch()
+{
+    std::array<float, i2c_sensor_device::max_channels> buffer;
+    const std::span<float> values{buffer.data(), device_.get_channels().size()};
+    std::fill(values.begin(), values.end(), NAN);
+
+    const auto err = device_.fetch(values);
+    if (err != ESP_OK)
+    {
+        return failed("fetch", err);
+    }
+
+    failures_ = 0;
+    state_ = state::idle;
+    callback_(device_, values);
+
+    // the conversion wait was part of this interval
+    const auto interval = interval_();
+    return interval > ready_after_ms_ ? interval - ready_after_ms_ : 1;
+}
+
+uint32_t i2c_sensor_runner::failed(const char *operation, esp_err_t err)
+{
+    ESP_LOGE(HARDWARE_TAG, "Failed to %s %s with error:%s", operation, device_.get_name(), esp_err_to_name(err));
+    publish_invalid();
+
+    if (++failures_ >= max_failures)
+    {
+        ESP_LOGW(HARDWARE_TAG, "Reinitializing %s after %u failures", device_.get_name(), failures_);
+        state_ = state::uninitialized;
+        return retry_init_ms;
+    }
+
+    state_ = state::idle;
+    return interval_();
+}
+
+void i2c_sensor_runner::publish_invalid()
+{
+    std::array<float, i2c_sensor_device::max_channels> buffer;
+    const std::span<float> values{buffer.data(), device_.get_channels().size()};
+    std::fill(values.begin(), values.end(), NAN);
+    callback_(device_, values);
+}
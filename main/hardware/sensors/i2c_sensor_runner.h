@@ -0,0 +1,57 @@
+#pragma once
+
+#include "hardware/sensors/i2c_sensor_device.h"
+#include <functional>
+#include <span>
+#include <stdint.h>
+
+/**
+ * Drives one i2c_sensor_device through init, start and fetch as a deadline_scheduler job,
+ * so a slow conversion(like the 5s of a SCD4x) only delays that device.
+ * Failed reads are reported as invalid values, the device is initialized again after repeated failures.
+ */
+class i2c_sensor_runner
+{
+  public:
+    // returns the milliseconds between measurements
+    using interval_t = std::function<uint32_t(void)>;
+    // values are in the order of device.get_channels(), NAN if the read failed
+    using values_callback_t = std::function<void(const i2c_sensor_device &device, std::span<const float> values)>;
+
+    i2c_sensor_runner(i2c_sensor_device &device, const interval_t &interval, const values_callback_t &callback)
+        : device_(device), interval_(interval), callback_(callback)
+    {
+    }
+
+    /**
+     * Advances the state machine, returns the milliseconds until the next step.
+     */
+    uint32_t step();
+
+  private:
+    enum class state : uint8_t
+    {
+        uninitialized,
+        idle,
+        measuring,
+    };
+
+    static constexpr uint8_t max_failures = 3;
+    static constexpr uint32_t retry_init_ms = 1000;
+    static constexpr uint32_t max_retry_init_ms = 60 * 1000;
+
+    i2c_sensor_device &device_;
+    const interval_t interval_;
+    const values_callback_t callback_;
+    state state_{state::uninitialized};
+    uint8_t failures_{0};
+    uint8_t init_failures_{0};
+    // time spent waiting for the conversion, taken off the next interval
+    uint32_t ready_after_ms_{0};
+
+    uint32_t init();
+    uint32_t start();
+    uint32_t fetch();
+    uint32_t failed(const char *operation, esp_err_t err);
+    void publish_invalid();
+};
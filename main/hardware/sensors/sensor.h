@@ -1,14 +1,20 @@
 #pragma once
 
+#include "hardware/sensors/history_kernels.h"
 #include "hardware/sensors/sensor_id.h"
 #include "util/circular_buffer.h"
+#include "util/misc.h"
 #include "util/psram_allocator.h"
+#include "util/quantile_histogram.h"
 #include "util/semaphore_lockable.h"
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cmath>
+#include <limits>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <type_traits>
 #include <vector>
 
@@ -46,13 +52,59 @@ class sensor_definition_display
     const sensor_level level;
 };
 
+/**
+ * When a new sensor value is worth a SENSOR_VALUE_CHANGE event. Values are compared with the last published one,
+ * so slow drifts are published once they add up to the deadband. Becoming valid or invalid is always published.
+ * The default publishes every change.
+ */
+class sensor_publish_policy
+{
+  public:
+    constexpr sensor_publish_policy() noexcept = default;
+    constexpr sensor_publish_policy(float absolute_deadband, float relative_deadband, uint32_t min_interval_ms, uint32_t heartbeat_ms) noexcept
+        : absolute_deadband(absolute_deadband), relative_deadband(relative_deadband), min_interval_ms(min_interval_ms),
+          heartbeat_ms(heartbeat_ms)
+    {
+    }
+
+    constexpr bool should_publish(float value, float published, uint32_t since_published_ms) const noexcept
+    {
+        if (std::isnan(value) != std::isnan(published))
+        {
+            return true;
+        }
+
+        if (since_published_ms < min_interval_ms)
+        {
+            return false;
+        }
+
+        if (heartbeat_ms && (since_published_ms >= heartbeat_ms))
+        {
+            return true;
+        }
+
+        const auto change = std::abs(value - published);
+        return (change > 0) && (change >= std::max(absolute_deadband, relative_deadband * std::abs(published)));
+    }
+
+  public:
+    const float absolute_deadband{};
+    // fraction of the published value
+    const float relative_deadband{};
+    const uint32_t min_interval_ms{};
+    // publish at least this often even without change, 0 disables
+    const uint32_t heartbeat_ms{};
+};
+
 class sensor_definition
 {
   public:
     constexpr sensor_definition(const std::string_view &name, const std::string_view &unit, const sensor_definition_display *display_definitions,
-                                size_t display_definitions_count, float min_value, float max_value, float value_step) noexcept
+                                size_t display_definitions_count, float min_value, float max_value, float value_step,
+                                const sensor_publish_policy &publish_policy = {}) noexcept
         : name_{name}, unit_(unit), display_definitions_(display_definitions), display_definitions_count_(display_definitions_count),
-          min_value_(min_value), max_value_(max_value), value_step_(value_step)
+          min_value_(min_value), max_value_(max_value), value_step_(value_step), publish_policy_(publish_policy)
     {
     }
 
@@ -92,6 +144,11 @@ class sensor_definition
         return value_step_;
     }
 
+    constexpr const sensor_publish_policy &get_publish_policy() const noexcept
+    {
+        return publish_policy_;
+    }
+
   private:
     const std::string_view name_;
     const std::string_view unit_;
@@ -100,6 +157,7 @@ class sensor_definition
     const float min_value_;
     const float max_value_;
     const float value_step_;
+    const sensor_publish_policy publish_policy_;
 };
 
 class sensor_value
@@ -110,33 +168,34 @@ class sensor_value
         return value_.load();
     }
 
-    bool set_value(float value)
-    {
-        return set_value_(value);
-    }
-
-    bool set_invalid_value()
-    {
-        return set_value_(NAN);
-    }
-
-  private:
-    std::atomic<float> value_{NAN};
-
     /**
-     * Returns true if changed
+     * Returns true if the value should be published as per policy
      */
-    bool set_value_(float value)
+    bool set_value(float value, const sensor_publish_policy &policy, uint32_t now = esp32::millis())
     {
-        if (value_.exchange(value) != value)
+        value_.store(value);
+        if (policy.should_publish(value, published_value_, now - published_time_))
         {
+            published_value_ = value;
+            published_time_ = now;
             return true;
         }
         return false;
     }
+
+    bool set_invalid_value(const sensor_publish_policy &policy, uint32_t now = esp32::millis())
+    {
+        return set_value(NAN, policy, now);
+    }
+
+  private:
+    std::atomic<float> value_{NAN};
+    // only used by the writer
+    float published_value_{NAN};
+    uint32_t published_time_{};
 };
 
-template <uint16_t countT> class sensor_history_t
+template <uint16_t countT, uint32_t interval_msT> class sensor_history_t
 {
   public:
     typedef struct
@@ -144,86 +203,379 @@ template <uint16_t countT> class sensor_history_t
         float mean;
         float min;
         float max;
+        float p50;
+        float p90;
+        float p99;
     } stats;
 
-    using vector_history_t = std::vector<float, esp32::psram::allocator<float>>;
+    // number of entries kept
+    static constexpr uint16_t count = countT;
+
+    // longest time between two values that is interpolated, instead of recorded as gaps
+    static constexpr uint32_t max_interpolate_ms = 60 * 1000;
+
+    // values are stored as fixed point with two decimals, gap_value marks a missing read
+    using value_t = history_kernels::value_t;
+    static constexpr value_t gap_value = history_kernels::gap_value;
+    static constexpr int8_t value_exponent = -2;
+    static constexpr float value_scale = 100;
+
+    using vector_history_t = std::vector<value_t, esp32::psram::allocator<value_t>>;
+    using vector_position_t = std::vector<uint32_t, esp32::psram::allocator<uint32_t>>;
 
     typedef struct
     {
         std::optional<stats> stat;
+        // fixed point values, see to_value
         vector_history_t history;
+        // entry sequence of each history value, only filled for downsampled snapshots
+        vector_position_t positions;
+        // index of the oldest point still in the window
+        uint32_t first;
+        // index of history[0]
+        uint32_t start;
+        // pass back as since to get only newer points, a partial last point is returned again as it can still change
+        uint32_t cursor;
+        // milliseconds covered by each point
+        uint32_t interval;
+        // milliseconds since the newest value was added
+        uint64_t age;
     } sensor_history_snapshot;
 
-    void add_value(float value)
+    static value_t from_value(float value)
+    {
+        if (std::isnan(value))
+        {
+            return gap_value;
+        }
+        const auto scaled = std::round(value * value_scale);
+        return static_cast<value_t>(std::clamp<float>(scaled, gap_value + 1, std::numeric_limits<value_t>::max()));
+    }
+
+    static float to_value(value_t value)
+    {
+        return value == gap_value ? NAN : value / value_scale;
+    }
+
+    /**
+     * Sets the expected range of values, used for percentile bins. Clears the history.
+     */
+    void set_range(float min, float max)
+    {
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        last_x_values_.clear();
+        quantiles_.set_range(from_value(min), from_value(max));
+    }
+
+    /**
+     * Adds a value taken at now, NAN records a failed read.
+     * Time is split in interval_msT slots and each entry is the mean of the valid values read in its slot,
+     * so values can be added at any rate. Slots missed between two valid values at most max_interpolate_ms
+     * apart are interpolated, longer runs of missed slots are recorded as gap entries.
+     */
+    void add_value(float value, uint64_t now = esp32::millis64())
     {
         std::lock_guard<esp32::semaphore> lock(data_mutex_);
-        last_x_values_.push(value);
+        const auto new_value = from_value(value);
+        const uint64_t slot = now / interval_msT;
+        last_value_time_ = now;
+        const bool has_slot = sequence_ && (last_slot_ != no_slot);
+
+        if (has_slot && (slot == last_slot_))
+        {
+            if (new_value != gap_value)
+            {
+                slot_sum_ += new_value;
+                slot_count_++;
+                replace_last(static_cast<value_t>(std::lround(static_cast<float>(slot_sum_) / slot_count_)));
+            }
+            return;
+        }
+
+        if (has_slot && (slot > last_slot_ + 1))
+        {
+            const uint64_t missed = slot - last_slot_ - 1;
+            const auto previous = last_x_values_.last();
+            if ((missed * interval_msT <= max_interpolate_ms) && (previous != gap_value) && (new_value != gap_value))
+            {
+                for (uint64_t i = 1; i <= missed; i++)
+                {
+                    push(static_cast<value_t>(previous + std::lround(static_cast<float>(new_value - previous) * i / (missed + 1))));
+                }
+            }
+            else
+            {
+                for (uint64_t i = 0; i < std::min<uint64_t>(missed, countT); i++)
+                {
+                    push(gap_value);
+                }
+            }
+            sequence_ += missed;
+        }
+
+        push(new_value);
+        sequence_++;
+        last_slot_ = slot;
+        slot_sum_ = (new_value != gap_value) ? new_value : 0;
+        slot_count_ = (new_value != gap_value) ? 1 : 0;
     }
 
     void clear()
     {
         std::lock_guard<esp32::semaphore> lock(data_mutex_);
         last_x_values_.clear();
+        quantiles_.clear();
     }
 
-    sensor_history_snapshot get_snapshot(uint8_t group_by_count) const
+    /**
+     * Copies the entries oldest first into values, returns the number copied.
+     * sequence is set to the sequence of the next entry.
+     */
+    size_t copy_values(std::span<value_t> values, uint32_t &sequence) const
     {
-        vector_history_t return_values;
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        const auto size = std::min<size_t>(values.size(), last_x_values_.size());
+        std::copy(last_x_values_.end() - size, last_x_values_.end(), values.begin());
+        sequence = sequence_;
+        return size;
+    }
 
+    /**
+     * Copies the entries oldest first into values as means of group_by_count entries, returns the number copied.
+     * Groups are aligned on sequence like in get_snapshot, so the first and the last group can be partial.
+     * sequence is set to the sequence of the next entry.
+     */
+    size_t copy_grouped_values(std::span<value_t> values, uint8_t group_by_count, uint32_t &sequence) const
+    {
         std::lock_guard<esp32::semaphore> lock(data_mutex_);
         const auto size = last_x_values_.size();
+        sequence = sequence_;
+        if (!size)
+        {
+            return 0;
+        }
+
+        size_t count = 0;
+        const auto add_group = [&values, &count](value_t mean) {
+            if (count < values.size())
+            {
+                values[count++] = mean;
+            }
+        };
+
+        history_kernels::group_state state{};
+        state.filled = (sequence_ - size) % group_by_count;
+        const auto [head, tail] = last_x_values_.as_spans();
+        history_kernels::grouped_mean(head, group_by_count, state, add_group);
+        history_kernels::grouped_mean(tail, group_by_count, state, add_group);
+        if (state.filled)
+        {
+            add_group(history_kernels::mean(state.sum));
+        }
+        return count;
+    }
+
+    /**
+     * Replaces the history with values(oldest first) where sequence is the sequence of the next entry,
+     * as saved by copy_values. The time between the saved entries and now is not known, so a single
+     * gap entry is added to mark the boundary.
+     */
+    void restore(std::span<const value_t> values, uint32_t sequence, uint64_t now = esp32::millis64())
+    {
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        last_x_values_.clear();
+        quantiles_.clear();
+        if (values.size() > countT)
+        {
+            values = values.subspan(values.size() - countT);
+        }
+        for (auto &&value : values)
+        {
+            push(value);
+        }
+        sequence_ = sequence;
+        if (sequence_)
+        {
+            push(gap_value);
+            sequence_++;
+            last_value_time_ = now;
+            // the gap entry belongs to no slot, the next value gets its own entry instead of replacing it
+            last_slot_ = no_slot;
+            slot_sum_ = 0;
+            slot_count_ = 0;
+        }
+    }
+
+    /**
+     * Returns stats for the whole window and history grouped by group_by_count entries.
+     * Points have a stable index (entry sequence / group_by_count), only points with index >= since are returned.
+     */
+    sensor_history_snapshot get_snapshot(uint8_t group_by_count, uint32_t since = 0) const
+    {
+        sensor_history_snapshot snapshot{};
+        snapshot.interval = group_by_count * interval_msT;
+
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        const auto size = last_x_values_.size();
+        const auto first_sequence = sequence_ - size;
+
+        snapshot.first = first_sequence / group_by_count;
+        snapshot.cursor = sequence_ / group_by_count;
+        snapshot.age = esp32::millis64() - last_value_time_;
+
+        // cursor from before a reboot
+        if (since > snapshot.cursor)
+        {
+            since = 0;
+        }
+        snapshot.start = std::max(since, snapshot.first);
+
         if (size)
         {
-            return_values.reserve(1 + (size / group_by_count));
-            float value_max = std::numeric_limits<float>::min();
-            float value_min = std::numeric_limits<float>::max();
-            double sum = 0;
-            double group_sum = 0;
-            for (auto i = 0; i < size; i++)
+            snapshot.history.reserve(1 + (sequence_ - 1) / group_by_count - snapshot.start);
+
+            // groups are aligned on sequence, the first one can be partial
+            const uint32_t begin_sequence = std::max<uint32_t>(snapshot.start * group_by_count, first_sequence);
+            history_kernels::group_state state{};
+            state.filled = begin_sequence % group_by_count;
+
+            const auto [head, tail] = last_x_values_.as_spans(begin_sequence - first_sequence, sequence_ - begin_sequence);
+            const auto add_group = [&snapshot](value_t mean) { snapshot.history.push_back(mean); };
+            history_kernels::grouped_mean(head, group_by_count, state, add_group);
+            history_kernels::grouped_mean(tail, group_by_count, state, add_group);
+
+            // last group is partial
+            if (state.filled)
             {
-                const auto value = last_x_values_[i];
-                sum += value;
-                group_sum += value;
-                value_max = std::max<float>(value, value_max);
-                value_min = std::min<float>(value, value_min);
+                add_group(history_kernels::mean(state.sum));
+            }
+
+            snapshot.stat = calculate_stats();
+        }
+
+        return snapshot;
+    }
+
+    /**
+     * Returns stats for the whole window and at most points entries from sequence since onwards,
+     * picked with Largest-Triangle-Three-Buckets so that peaks survive.
+     * Buckets without any valid entry produce a gap value.
+     */
+    sensor_history_snapshot get_downsampled_snapshot(uint16_t points, uint32_t since = 0) const
+    {
+        sensor_history_snapshot snapshot{};
+        snapshot.interval = interval_msT;
+
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        const auto size = last_x_values_.size();
+        const auto entries = last_x_values_.begin();
+        const uint32_t first_sequence = sequence_ - size;
+
+        snapshot.first = first_sequence;
+        snapshot.cursor = sequence_;
+        snapshot.age = esp32::millis64() - last_value_time_;
+
+        if (since > sequence_)
+        {
+            since = 0;
+        }
+        snapshot.start = std::max(since, first_sequence);
+
+        const size_t begin = snapshot.start - first_sequence;
+        const size_t total = size - begin;
+
+        if (total)
+        {
+            snapshot.stat = calculate_stats();
+
+            const auto add_point = [&snapshot, first_sequence](size_t index, value_t value) {
+                snapshot.history.push_back(value);
+                snapshot.positions.push_back(first_sequence + index);
+            };
 
-                if (((i + 1) % group_by_count) == 0)
+            if (total <= points || points < 3)
+            {
+                snapshot.history.reserve(total);
+                snapshot.positions.reserve(total);
+                for (auto i = begin; i < size; i++)
                 {
-                    return_values.push_back(group_sum / (group_by_count));
-                    group_sum = 0;
+                    add_point(i, entries[i]);
                 }
+                return snapshot;
             }
 
-            // add partial group average
-            if (size % group_by_count)
+            snapshot.history.reserve(points);
+            snapshot.positions.reserve(points);
+
+            // first and last entries are always kept, rest are split into points - 2 buckets
+            const float bucket_size = static_cast<float>(total - 2) / (points - 2);
+            const auto bucket_begin = [begin, bucket_size](size_t bucket) { return begin + 1 + static_cast<size_t>(bucket * bucket_size); };
+
+            // a leading gap is returned as is, but the first valid entry is the anchor of the first triangle
+            add_point(begin, entries[begin]);
+            size_t selected = begin;
+            while ((selected + 1 < size) && (entries[selected] == gap_value))
             {
-                return_values.push_back(group_sum / (size % group_by_count));
+                selected++;
             }
 
-            stats stats_value;
-            stats_value.max = value_max;
-            stats_value.min = value_min;
-            stats_value.mean = sum / size;
-            return {stats_value, return_values};
+            for (size_t bucket = 0; bucket < static_cast<size_t>(points - 2); bucket++)
+            {
+                const auto current_begin = bucket_begin(bucket);
+                const auto current_end = bucket_begin(bucket + 1);
+                const auto next_end = std::min<size_t>(bucket_begin(bucket + 2), size);
+
+                // third vertex is the average of the valid entries of the next bucket, for the last bucket it is the last entry
+                const auto [next_head, next_tail] = last_x_values_.as_spans(current_end, next_end - current_end);
+                auto average = history_kernels::point_sum(next_head, current_end);
+                average = history_kernels::point_sum(next_tail, current_end + next_head.size(), average);
+
+                const auto selected_value = entries[selected];
+                float average_x;
+                float average_y;
+                if (average.count)
+                {
+                    average_x = average.x / average.count;
+                    average_y = static_cast<float>(average.y) / average.count;
+                }
+                else
+                {
+                    average_x = (current_end + next_end) / 2.0f;
+                    average_y = selected_value;
+                }
+
+                const auto [current_head, current_tail] = last_x_values_.as_spans(current_begin, current_end - current_begin);
+                auto triangle =
+                    history_kernels::largest_triangle(current_head, current_begin, selected, selected_value, average_x, average_y);
+                triangle = history_kernels::largest_triangle(current_tail, current_begin + current_head.size(), selected, selected_value,
+                                                             average_x, average_y, triangle);
+
+                if (triangle.area < 0)
+                {
+                    add_point(current_begin, gap_value);
+                }
+                else
+                {
+                    selected = triangle.index;
+                    add_point(selected, entries[selected]);
+                }
+            }
+
+            add_point(size - 1, entries[size - 1]);
         }
-        else
-        {
-            return {std::nullopt, return_values};
-        };
+
+        return snapshot;
     }
 
     std::optional<float> get_average() const
     {
         std::lock_guard<esp32::semaphore> lock(data_mutex_);
-        const auto size = last_x_values_.size();
-        if (size)
+        const auto [head, tail] = last_x_values_.as_spans();
+        const auto sum = history_kernels::sum(tail, history_kernels::sum(head));
+
+        if (sum.count)
         {
-            double sum = 0;
-            for (auto i = 0; i < size; i++)
-            {
-                sum += last_x_values_[i];
-            }
-            return sum / size;
+            return static_cast<float>(sum.sum) / sum.count / value_scale;
         }
         else
         {
@@ -232,11 +584,98 @@ template <uint16_t countT> class sensor_history_t
     }
 
   private:
+    // caller holds data_mutex_, keeps the percentile histogram in sync with the window
+    void push(value_t value)
+    {
+        if (last_x_values_.is_full())
+        {
+            const auto evicted = last_x_values_.first();
+            if (evicted != gap_value)
+            {
+                quantiles_.remove(evicted);
+            }
+        }
+
+        last_x_values_.push(value);
+        if (value != gap_value)
+        {
+            quantiles_.add(value);
+        }
+    }
+
+    // caller holds data_mutex_
+    void replace_last(value_t value)
+    {
+        const auto replaced = last_x_values_.pop();
+        if (replaced != gap_value)
+        {
+            quantiles_.remove(replaced);
+        }
+
+        last_x_values_.push(value);
+        if (value != gap_value)
+        {
+            quantiles_.add(value);
+        }
+    }
+
+  public:
+    /**
+     * Value at quantile q(0-1) of the whole window, nullopt if there are no values.
+     */
+    std::optional<float> get_quantile(float q) const
+    {
+        std::lock_guard<esp32::semaphore> lock(data_mutex_);
+        const auto value = quantiles_.quantile(q);
+        if (value)
+        {
+            return *value / value_scale;
+        }
+        return std::nullopt;
+    }
+
+  private:
+    // caller holds data_mutex_
+    std::optional<stats> calculate_stats() const
+    {
+        const auto [head, tail] = last_x_values_.as_spans();
+        const auto sum = history_kernels::sum(tail, history_kernels::sum(head));
+        const auto min_max = history_kernels::min_max(tail, history_kernels::min_max(head));
+
+        if (sum.count)
+        {
+            stats stats_value;
+            stats_value.max = to_value(min_max.max);
+            stats_value.min = to_value(min_max.min);
+            stats_value.mean = static_cast<float>(sum.sum) / sum.count / value_scale;
+            stats_value.p50 = quantiles_.quantile(0.5f).value_or(NAN) / value_scale;
+            stats_value.p90 = quantiles_.quantile(0.9f).value_or(NAN) / value_scale;
+            stats_value.p99 = quantiles_.quantile(0.99f).value_or(NAN) / value_scale;
+            return stats_value;
+        }
+        return std::nullopt;
+    }
+
     mutable esp32::semaphore data_mutex_;
-    circular_buffer<float, countT> last_x_values_;
+    circular_buffer<value_t, countT> last_x_values_;
+    // percentiles of the values in last_x_values_
+    quantile_histogram<256> quantiles_;
+    // time of the newest value
+    uint64_t last_value_time_{};
+    // slot(time / interval_msT) of the newest entry and the valid values averaged into it
+    static constexpr uint64_t no_slot = std::numeric_limits<uint64_t>::max();
+    uint64_t last_slot_{};
+    int32_t slot_sum_{};
+    uint16_t slot_count_{};
+    // total entries added including gaps, sequence of the next entry
+    uint32_t sequence_{};
+
+    static_assert(static_cast<uint64_t>(countT) * std::numeric_limits<value_t>::max() <= std::numeric_limits<int32_t>::max(),
+                  "sum can overflow");
 };
 
-template <uint8_t reads_per_minuteT, uint16_t minutesT> class sensor_history_minute_t : public sensor_history_t<reads_per_minuteT * minutesT>
+template <uint8_t reads_per_minuteT, uint16_t minutesT>
+class sensor_history_minute_t : public sensor_history_t<reads_per_minuteT * minutesT, (60u * 1000 / reads_per_minuteT)>
 {
   public:
     static constexpr auto total_minutes = minutesT;
@@ -248,11 +687,21 @@ using sensor_history = sensor_history_minute_t<12, 720>;
 
 constexpr std::array<sensor_definition_display, 0> no_level{};
 
+// 0.2%RH and 0.1C are about the sensor repeatability, heartbeat keeps idle clients fresh
+constexpr sensor_publish_policy humidity_publish_policy{0.2f, 0, 1000, 5 * 60 * 1000};
+constexpr sensor_publish_policy temperature_publish_policy{0.1f, 0, 1000, 5 * 60 * 1000};
+constexpr sensor_publish_policy absolute_humidity_publish_policy{0.1f, 0, 1000, 5 * 60 * 1000};
+
 constexpr std::array<sensor_definition, total_sensors> sensor_definitions
 {
-        sensor_definition{"Humidity-1", "⁒", no_level.data(), no_level.size(), 0, 100, 1},
-        sensor_definition{"Humidity-2", "⁒", no_level.data(), no_level.size(), 0, 100, 1},
-        sensor_definition{"Humidity", "⁒", no_level.data(), no_level.size(), 0, 100, 1},
+        sensor_definition{"Humidity-1", "⁒", no_level.data(), no_level.size(), 0, 100, 1, humidity_publish_policy},
+        sensor_definition{"Humidity-2", "⁒", no_level.data(), no_level.size(), 0, 100, 1, humidity_publish_policy},
+        sensor_definition{"Humidity", "⁒", no_level.data(), no_level.size(), 0, 100, 1, humidity_publish_policy},
+        sensor_definition{"Temperature-1", "℃", no_level.data(), no_level.size(), -20, 80, 0.1, temperature_publish_policy},
+        sensor_definition{"Temperature-2", "℃", no_level.data(), no_level.size(), -20, 80, 0.1, temperature_publish_policy},
+        sensor_definition{"Temperature", "℃", no_level.data(), no_level.size(), -20, 80, 0.1, temperature_publish_policy},
+        sensor_definition{"Dew Point", "℃", no_level.data(), no_level.size(), -20, 80, 0.1, temperature_publish_policy},
+        sensor_definition{"Absolute Humidity", "g/m³", no_level.data(), no_level.size(), 0, 100, 0.1, absolute_humidity_publish_policy},
 };
 
 constexpr auto &&get_sensor_definition(sensor_id_index id)
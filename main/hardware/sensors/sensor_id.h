@@ -10,7 +10,12 @@ enum class sensor_id_index : uint8_t
     first = humidity1,
     humidity2,
     humidity, // average
-    last = humidity,
+    temperature1,
+    temperature2,
+    temperature, // average
+    dew_point,
+    absolute_humidity,
+    last = absolute_humidity,
 };
 
 constexpr auto total_sensors = static_cast<size_t>(sensor_id_index::last) + 1;
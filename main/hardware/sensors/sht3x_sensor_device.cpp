@@ -1,39 +1,74 @@
-
-
 #include "hardware/sensors/sht3x_sensor_device.h"
 
 #include "logging/logging_tags.h"
-#include "util/exceptions.h"
 #include "util/misc.h"
-#include "util/noncopyable.h"
+#include <esp_check.h>
 #include <esp_log.h>
 #include <i2cdev.h>
 
-void sht3x_sensor_device::init(i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio)
+esp_err_t sht3x_sensor_device::init(uint32_t &ready_after_ms)
 {
-    // sht3x
-    CHECK_THROW_ESP(sht3x_init_desc(&sht3x_sensor_, SHT3X_I2C_ADDR_GND, port, sda_gpio, scl_gpio));
-    CHECK_THROW_ESP(sht3x_init(&sht3x_sensor_));
-}
+    // the descriptor and its lock live as long as the device, init is retried after failures
+    if (!descriptor_created_)
+    {
+        ESP_RETURN_ON_ERROR(sht3x_init_desc(&sht3x_sensor_, SHT3X_I2C_ADDR_GND, bus_.port, bus_.sda_gpio, bus_.scl_gpio), SENSOR_SHT31_TAG,
+                            "Failed to create descriptor");
+        descriptor_created_ = true;
+    }
 
-std::array<std::tuple<sensor_id_index, float>, 1> sht3x_sensor_device::read()
-{
-    float temperatureC = NAN;
-    float humidity = NAN;
-    auto err = sht3x_measure(&sht3x_sensor_, &temperatureC, &humidity);
-    if (err == ESP_OK)
+    ESP_RETURN_ON_ERROR(sht3x_init(&sht3x_sensor_), SENSOR_SHT31_TAG, "Failed to init");
+
+    ready_after_ms = 0;
+    if (mode_ != SHT3X_SINGLE_SHOT)
     {
-        ESP_LOGI(SENSOR_SHT31_TAG, "Read SHT31 sensor values:%g C  %g %%", temperatureC, humidity);
+        ESP_RETURN_ON_ERROR(sht3x_start_measurement(&sht3x_sensor_, mode_, SHT3X_HIGH), SENSOR_SHT31_TAG, "Failed to start periodic mode");
+        ready_after_ms = get_measurement_duration_ms();
     }
-    else
+    return ESP_OK;
+}
+
+esp_err_t sht3x_sensor_device::start(uint32_t &ready_after_ms)
+{
+    if (mode_ != SHT3X_SINGLE_SHOT)
     {
-        ESP_LOGE(SENSOR_SHT31_TAG, "Failed to read from SHT3x sensor with error:%s", esp_err_to_name(err));
+        ready_after_ms = 0;
+        return ESP_OK;
     }
 
-    return {std::tuple<sensor_id_index, float>{sensor_id, esp32::round_with_precision(humidity, 2)}};
+    ESP_RETURN_ON_ERROR(sht3x_start_measurement(&sht3x_sensor_, SHT3X_SINGLE_SHOT, SHT3X_HIGH), SENSOR_SHT31_TAG,
+                        "Failed to start measurement");
+    ready_after_ms = get_measurement_duration_ms();
+    return ESP_OK;
+}
+
+esp_err_t sht3x_sensor_device::fetch(std::span<float> values)
+{
+    float temperatureC = NAN;
+    float humidity = NAN;
+    ESP_RETURN_ON_ERROR(sht3x_get_results(&sht3x_sensor_, &temperatureC, &humidity), SENSOR_SHT31_TAG, "Failed to read results");
+
+    ESP_LOGD(SENSOR_SHT31_TAG, "Read %s sensor values:%g C  %g %%", name_, temperatureC, humidity);
+    values[0] = esp32::round_with_precision(humidity, 0.01f);
+    values[1] = esp32::round_with_precision(temperatureC, 0.01f);
+    return ESP_OK;
 }
 
-uint8_t sht3x_sensor_device::get_initial_delay()
+uint32_t sht3x_sensor_device::get_measurement_duration_ms() const
 {
-    return sht3x_get_measurement_duration(SHT3X_HIGH);
+    // first periodic result is there after one period
+    switch (mode_)
+    {
+    case SHT3X_PERIODIC_05MPS:
+        return 2000;
+    case SHT3X_PERIODIC_1MPS:
+        return 1000;
+    case SHT3X_PERIODIC_2MPS:
+        return 500;
+    case SHT3X_PERIODIC_4MPS:
+        return 250;
+    case SHT3X_PERIODIC_10MPS:
+        return 100;
+    default:
+        return pdTICKS_TO_MS(sht3x_get_measurement_duration(SHT3X_HIGH));
+    }
 }
@@ -1,24 +1,44 @@
 #pragma once
 #include "sdkconfig.h"
 
+#include "hardware/sensors/i2c_sensor_device.h"
 #include "hardware/sensors/sensor_id.h"
-#include "util/singleton.h"
 #include <array>
 #include <i2cdev.h>
 #include <sht3x.h>
-#include <tuple>
-#include "util/noncopyable.h"
 
-class sht3x_sensor_device final : public esp32::noncopyable
+class sht3x_sensor_device final : public i2c_sensor_device
 {
   public:
-    sht3x_sensor_device(sensor_id_index id) : sensor_id(id) {}
-    void init(i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
-    std::array<std::tuple<sensor_id_index, float>, 1> read();
+    // in a periodic mode the sensor measures on its own at that rate and fetch() only reads the latest result
+    sht3x_sensor_device(const char *name, const i2c_bus &bus, sensor_id_index humidity_id, sensor_id_index temperature_id,
+                        sht3x_mode_t mode = SHT3X_PERIODIC_1MPS)
+        : name_(name), bus_(bus), channels_{humidity_id, temperature_id}, mode_(mode)
+    {
+    }
 
-    uint8_t get_initial_delay();
+    const char *get_name() const override
+    {
+        return name_;
+    }
+
+    // humidity and temperature
+    std::span<const sensor_id_index> get_channels() const override
+    {
+        return channels_;
+    }
+
+    esp_err_t init(uint32_t &ready_after_ms) override;
+    esp_err_t start(uint32_t &ready_after_ms) override;
+    esp_err_t fetch(std::span<float> values) override;
 
   private:
+    const char *const name_;
+    const i2c_bus bus_;
+    const std::array<sensor_id_index, 2> channels_;
+    const sht3x_mode_t mode_;
     sht3x_t sht3x_sensor_{};
-    const sensor_id_index sensor_id;
+    bool descriptor_created_{false};
+
+    uint32_t get_measurement_duration_ms() const;
 };
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <stdint.h>
+
+/**
+ * Detects a running shower from the humidity rate of change, fed one sample at a time.
+ * The rate is an EWMA of dRH/dt, which follows a shower starting within a few fast samples.
+ * A shower starts when humidity rises fast, is well above the baseline(the usual humidity of the room)
+ * and the room was recently occupied. It stops once humidity is back close to the baseline,
+ * or after max_on_ms if nobody is there anymore.
+ */
+class shower_detector
+{
+  public:
+    struct policy
+    {
+        // EWMA time constant of the rate
+        uint32_t rate_time_constant_ms;
+        // per minute
+        float start_rate;
+        // above baseline
+        float start_rise;
+        float stop_rise;
+        uint32_t min_on_ms;
+        uint32_t max_on_ms;
+        // occupancy seen this recently counts for start
+        uint32_t occupancy_hold_ms;
+    };
+
+    constexpr shower_detector(const policy &policy) : policy_(policy)
+    {
+    }
+
+    /**
+     * Updates with a sample taken at now(ms), returns true if is_active() changed.
+     */
+    bool update(float humidity, float baseline, bool occupied, uint64_t now)
+    {
+        if (occupied)
+        {
+            last_occupied_time_ = now;
+            occupancy_seen_ = true;
+        }
+
+        if (std::isnan(humidity))
+        {
+            return false;
+        }
+
+        if (!std::isnan(last_humidity_) && (now > last_time_))
+        {
+            const float elapsed = now - last_time_;
+            const float rate = (humidity - last_humidity_) * 60000 / elapsed;
+            rate_ += (rate - rate_) * elapsed / (policy_.rate_time_constant_ms + elapsed);
+        }
+        last_humidity_ = humidity;
+        last_time_ = now;
+
+        // without a baseline(history too short for a median) a shower cannot start,
+        // a running one is measured against the last baseline there was
+        if (!std::isnan(baseline))
+        {
+            last_baseline_ = baseline;
+        }
+        const float rise = humidity - last_baseline_;
+        const bool recently_occupied = occupancy_seen_ && (now - last_occupied_time_ <= policy_.occupancy_hold_ms);
+
+        if (!active_)
+        {
+            if (!std::isnan(baseline) && (rate_ >= policy_.start_rate) && (rise >= policy_.start_rise) && recently_occupied)
+            {
+                active_ = true;
+                start_time_ = now;
+                return true;
+            }
+            return false;
+        }
+
+        const auto on_time = now - start_time_;
+        if (on_time < policy_.min_on_ms)
+        {
+            return false;
+        }
+
+        if ((rise <= policy_.stop_rise) || ((on_time >= policy_.max_on_ms) && !recently_occupied))
+        {
+            active_ = false;
+            return true;
+        }
+        return false;
+    }
+
+    bool is_active() const
+    {
+        return active_;
+    }
+
+    // EWMA of the humidity change per minute
+    float get_rate() const
+    {
+        return rate_;
+    }
+
+  private:
+    const policy policy_;
+    bool active_{false};
+    bool occupancy_seen_{false};
+    float rate_{0};
+    float last_humidity_{NAN};
+    float last_baseline_{NAN};
+    uint64_t last_time_{};
+    uint64_t last_occupied_time_{};
+    uint64_t start_time_{};
+};
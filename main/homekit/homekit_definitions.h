@@ -44,6 +44,8 @@ struct homekit_definition
 constexpr auto homekit_definitions = std::to_array<homekit_definition>({
         homekit_definition{sensor_id_index::humidity, HAP_SERV_UUID_HUMIDITY_SENSOR, HAP_CHAR_UUID_CURRENT_RELATIVE_HUMIDITY,
                            HAP_CHAR_UNIT_PERCENTAGE},
+        homekit_definition{sensor_id_index::temperature, HAP_SERV_UUID_TEMPERATURE_SENSOR, HAP_CHAR_UUID_CURRENT_TEMPERATURE,
+                           HAP_CHAR_UNIT_CELSIUS},
 });
 
 constexpr std::string_view primary_service{HAP_SERV_UUID_AIR_QUALITY_SENSOR};
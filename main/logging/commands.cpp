@@ -1,13 +1,18 @@
 #include "commands.h"
+#include "hardware/sensors/history_kernels.h"
+#include "hardware/sensors/sensor.h"
 #include "logging/logger.h"
 #include "logging/logging_tags.h"
+#include "util/gzip_encoder.h"
 #include "util/helper.h"
 #include <esp_log.h>
+#include <esp_random.h>
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <lwip/sockets.h>
 #include <string>
+#include <vector>
 
 static void up_time_cli_handler()
 {
@@ -123,6 +128,119 @@ static void sock_dump_cli_handler()
     ESP_LOGI(COMMAND_TAG, "Remaining sockets: %d", TOTAL_NUM_SOCKETS - used_sockets);
 }
 
+// times the history kernels against their portable versions over a full history of random values,
+// on the ESP32-S3 that is the PIE vector path against the scalar fallback
+static void kernel_bench_cli_handler()
+{
+    constexpr size_t size = sensor_history::count;
+    constexpr int runs = 20;
+
+    std::vector<history_kernels::value_t, esp32::psram::allocator<history_kernels::value_t>> values(size);
+    for (auto &&value : values)
+    {
+        value = (esp_random() % 16) ? static_cast<history_kernels::value_t>(esp_random() % 10000) : history_kernels::gap_value;
+    }
+    const std::span<const history_kernels::value_t> aligned(values.data(), values.size());
+    // like a ring segment, starts and ends off the vector alignment
+    const auto unaligned = aligned.subspan(3, size - 8);
+
+    const auto time = [](auto &&ftn) {
+        const auto start = esp_timer_get_time();
+        for (int i = 0; i < runs; i++)
+        {
+            ftn();
+        }
+        return (esp_timer_get_time() - start) / runs;
+    };
+
+    volatile int32_t sink = 0;
+    bool match = true;
+
+    const auto bench = [&](const char *name, std::span<const history_kernels::value_t> span) {
+        const auto portable_sum_us = time([&] {
+            const auto sum = history_kernels::portable::sum(span);
+            sink = sum.sum + sum.count;
+        });
+        const auto sum_us = time([&] {
+            const auto sum = history_kernels::sum(span);
+            sink = sum.sum + sum.count;
+        });
+        const auto portable_min_max_us = time([&] {
+            const auto min_max = history_kernels::portable::min_max(span);
+            sink = min_max.min + min_max.max;
+        });
+        const auto min_max_us = time([&] {
+            const auto min_max = history_kernels::min_max(span);
+            sink = min_max.min + min_max.max;
+        });
+
+        const auto portable_sum = history_kernels::portable::sum(span);
+        const auto sum = history_kernels::sum(span);
+        const auto portable_min_max = history_kernels::portable::min_max(span);
+        const auto min_max = history_kernels::min_max(span);
+        match = match && (portable_sum.sum == sum.sum) && (portable_sum.count == sum.count) && (portable_min_max.min == min_max.min) &&
+                (portable_min_max.max == min_max.max);
+
+        ESP_LOGI(COMMAND_TAG, "sum %-10s      %12lld  %10lld", name, portable_sum_us, sum_us);
+        ESP_LOGI(COMMAND_TAG, "min/max %-10s  %12lld  %10lld", name, portable_min_max_us, min_max_us);
+    };
+
+    ESP_LOGI(COMMAND_TAG, "Kernel              Portable(us)  %s(us)  Entries:%u", HISTORY_KERNELS_PIE ? "   PIE" : "Active", size);
+    bench("aligned", aligned);
+    bench("unaligned", unaligned);
+
+    if (!match)
+    {
+        ESP_LOGE(COMMAND_TAG, "Kernel results differ from the portable versions");
+    }
+}
+
+// compresses a JSON history like the one the web page requests, in the pieces the json writer flushes
+static void gzip_bench_cli_handler()
+{
+    constexpr size_t piece_size = 512;
+    constexpr int runs = 5;
+
+    esp32::psram::string json;
+    json.reserve(sensor_history::count * 8 + 32);
+    json.append("{\"history\":[");
+    int32_t value = 5000;
+    for (size_t i = 0; i < sensor_history::count; i++)
+    {
+        value = std::clamp<int32_t>(value + static_cast<int32_t>(esp_random() % 21) - 10, 0, 10000);
+        char str[16];
+        snprintf(str, sizeof(str), "%s%ld.%02ld", i ? "," : "", value / 100, value % 100);
+        json.append(str);
+    }
+    json.append("]}");
+
+    const std::span<const uint8_t> input(reinterpret_cast<const uint8_t *>(json.data()), json.size());
+    size_t output_size = 0;
+
+    const auto start = esp_timer_get_time();
+    for (int i = 0; i < runs; i++)
+    {
+        output_size = 0;
+        const auto encoder = esp32::gzip_encoder::try_create([&output_size](std::span<const uint8_t> data) { output_size += data.size(); });
+        if (!encoder)
+        {
+            ESP_LOGE(COMMAND_TAG, "Compressor is busy or out of memory");
+            return;
+        }
+
+        for (size_t offset = 0; offset < input.size(); offset += piece_size)
+        {
+            encoder->write(input.subspan(offset, std::min(piece_size, input.size() - offset)));
+        }
+        encoder->finish();
+    }
+    const auto time_us = (esp_timer_get_time() - start) / runs;
+
+    ESP_LOGI(COMMAND_TAG, "Input:%u bytes Output:%u bytes Saved:%u%%", input.size(), output_size,
+             static_cast<size_t>(100 - (output_size * 100 / input.size())));
+    ESP_LOGI(COMMAND_TAG, "Time:%lld us %lld KB/s", time_us, time_us ? input.size() * 1000000ll / 1024 / time_us : 0);
+}
+
 void run_command(const std::string_view &command)
 {
     esp_log_level_set(COMMAND_TAG, ESP_LOG_INFO);
@@ -146,4 +264,12 @@ void run_command(const std::string_view &command)
     {
         sock_dump_cli_handler();
     }
+    else if (command == "kernel-bench")
+    {
+        kernel_bench_cli_handler();
+    }
+    else if (command == "gzip-bench")
+    {
+        gzip_bench_cli_handler();
+    }
 }
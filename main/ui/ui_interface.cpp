@@ -4,6 +4,7 @@
 #include "hardware/hardware.h"
 #include "homekit/homekit_integration.h"
 #include "logging/logging_tags.h"
+#include "util/json_arena.h"
 #include <esp_app_desc.h>
 #include <esp_chip_info.h>
 #include <esp_efuse.h>
@@ -24,10 +25,10 @@ float ui_interface::get_sensor_value(sensor_id_index index)
     return hardware_->get_sensor_value(index);
 }
 
-sensor_history::sensor_history_snapshot ui_interface::get_sensor_detail_info(sensor_id_index index)
+sensor_history::sensor_history_snapshot ui_interface::get_sensor_detail_info(sensor_id_index index, uint32_t since, uint16_t points)
 {
     configASSERT(hardware_);
-    return hardware_->get_sensor_detail_info(index);
+    return hardware_->get_sensor_detail_info(index, since, points);
 }
 
 wifi_status ui_interface::get_wifi_status()
@@ -233,6 +234,7 @@ ui_interface::information_table_type ui_interface::get_information_table(informa
             {"Chip", get_chip_details()},
             {"Heap", get_heap_info_str(MALLOC_CAP_INTERNAL)},
             {"PsRam", get_heap_info_str(MALLOC_CAP_SPIRAM)},
+            {"Json Arenas", esp32::json_arena_pool::instance.get_stats_str()},
             {"Uptime", get_up_time()},
             {"Reset Reason", get_reset_reason_string()},
             {"Mac Address", get_default_mac_address()},
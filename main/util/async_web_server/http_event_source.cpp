@@ -1,7 +1,13 @@
 #include "http_event_source.h"
+#include "http_server.h"
 #include "logging/logging_tags.h"
 #include "util/helper.h"
+#include "util/misc.h"
+#include <algorithm>
+#include <cstdlib>
+#include <errno.h>
 #include <esp_log.h>
+#include <esp_random.h>
 #include <mutex>
 #include <string>
 #include <sys/socket.h>
@@ -28,70 +34,181 @@ event_source_connection::event_source_connection(event_source &source, http_requ
     CHECK_THROW_ESP(httpd_resp_send_chunk(req, crlf_sv.data(), crlf_sv.length()));
     req->sess_ctx = this;
     req->free_ctx = event_source_connection::destroy;
+    http_server::mark_stream(req);
 }
 
 void event_source_connection::destroy(void *ptr)
 {
     ESP_LOGI(WEBSERVER_TAG, "events disconnect");
     auto *connection = static_cast<event_source_connection *>(ptr);
-    connection->source_.connections_.erase(connection);
+    {
+        std::lock_guard<esp32::semaphore> lock(connection->source_.connections_mutex_);
+        connection->source_.connections_.erase(connection);
+        connection->source_.last_disconnect_ = millis64();
+    }
     delete connection;
 }
 
-void event_source_connection::try_send(const std::string_view &message, const std::string_view &event, uint32_t id, uint32_t reconnect)
+void event_source_connection::try_send(const event_frame_t &frame, uint32_t coalesce_key)
 {
-    if (fd_ == 0)
+    if ((fd_ == 0) || closing_)
     {
         return;
     }
 
-    std::string event_str;
-    event_str.reserve(256);
+    enqueue(frame, coalesce_key);
+    flush();
+}
+
+void event_source_connection::enqueue(const event_frame_t &frame, uint32_t coalesce_key)
+{
+    if (coalesce_key)
+    {
+        // a partially sent front frame has to be completed as is
+        const auto begin = queue_.begin() + (front_sent_ ? 1 : 0);
+        const auto iter =
+            std::find_if(begin, queue_.end(), [coalesce_key](const queued_frame &queued) { return queued.coalesce_key == coalesce_key; });
+        if (iter != queue_.end())
+        {
+            queued_bytes_ = queued_bytes_ - iter->frame->size() + frame->size();
+            iter->frame = frame;
+            return;
+        }
+    }
+
+    queue_.push_back({frame, coalesce_key});
+    queued_bytes_ += frame->size();
+
+    while ((queue_.size() > max_queued_frames) || (queued_bytes_ > max_queued_bytes))
+    {
+        if (queue_.size() <= (front_sent_ ? 2 : 1))
+        {
+            break;
+        }
+        drop_front_unsent();
+    }
+}
+
+// drops the oldest frame that was not started yet
+void event_source_connection::drop_front_unsent()
+{
+    const auto iter = queue_.begin() + (front_sent_ ? 1 : 0);
+    queued_bytes_ -= iter->frame->size();
+    queue_.erase(iter);
+}
+
+void event_source_connection::flush()
+{
+    if ((fd_ == 0) || closing_)
+    {
+        return;
+    }
+
+    while (!queue_.empty())
+    {
+        const auto &frame = *queue_.front().frame;
+        // straight to the socket, httpd_socket_send logs a warning for every EAGAIN of a slow client
+        const auto sent = send(fd_, frame.data() + front_sent_, frame.size() - front_sent_, MSG_DONTWAIT);
+        if ((sent == 0) || ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))))
+        {
+            // socket buffer is full
+            const auto now = millis64();
+            if (!stalled_since_)
+            {
+                stalled_since_ = now;
+            }
+            else if (now - stalled_since_ >= max_stall_ms)
+            {
+                ESP_LOGW(WEBSERVER_TAG, "Disconnecting stalled events client:%d", fd_);
+                close();
+            }
+            return;
+        }
+
+        if (sent < 0)
+        {
+            ESP_LOGD(WEBSERVER_TAG, "Events send failed for client:%d with:%d", fd_, errno);
+            close();
+            return;
+        }
+
+        stalled_since_ = 0;
+        front_sent_ += sent;
+        if (front_sent_ == frame.size())
+        {
+            queued_bytes_ -= frame.size();
+            queue_.pop_front();
+            front_sent_ = 0;
+        }
+    }
+}
+
+void event_source_connection::close()
+{
+    // destroy() runs once httpd has closed the session
+    closing_ = true;
+    queue_.clear();
+    queued_bytes_ = 0;
+    front_sent_ = 0;
+    httpd_sess_trigger_close(hd_, fd_);
+}
+
+event_frame_t event_source::format_event(const std::string_view &message, const std::string_view &event, uint32_t id, uint32_t reconnect)
+{
+    // chunk size line, content and chunk end in one buffer, so each connection needs a single send
+    // size is filled in at the end as fixed width hex, leading zeros are valid in a chunk size
+    constexpr size_t chunk_size_length = 8;
+    auto frame = std::allocate_shared<psram::string>(psram::allocator<psram::string>(), chunk_size_length, '0');
+    frame->reserve(256);
+    frame->append(crlf_sv);
+    const auto header_size = frame->size();
 
     if (reconnect)
     {
-        event_str.append(retry_sv);
-        event_str.append(esp32::string::to_string(reconnect));
-        event_str.append(crlf_sv);
+        frame->append(retry_sv);
+        frame->append(esp32::string::to_string(reconnect));
+        frame->append(crlf_sv);
     }
 
     if (id)
     {
-        event_str.append(id_sv);
-        event_str.append(esp32::string::to_string(id));
-        event_str.append(crlf_sv);
+        frame->append(id_sv);
+        frame->append(esp32::string::to_string(id));
+        frame->append(crlf_sv);
     }
 
     if (event.length())
     {
-        event_str.append(event_sv);
-        event_str.append(event);
-        event_str.append(crlf_sv);
+        frame->append(event_sv);
+        frame->append(event);
+        frame->append(crlf_sv);
     }
 
     if (message.length())
     {
-        event_str.append(data_sv);
-        event_str.append(message);
-        event_str.append(crlf_sv);
+        frame->append(data_sv);
+        frame->append(message);
+        frame->append(crlf_sv);
     }
 
-    if (event_str.empty())
+    if (frame->size() == header_size)
     {
-        return;
+        return nullptr;
     }
 
-    event_str.append(crlf_sv);
+    frame->append(crlf_sv);
 
-    // Sending chunked content prelude
-    const auto pre_event_str = esp32::string::snprintf("%x%s", 4 * sizeof(event_str.size()) + crlf_sv.length(), event_str.size(), crlf_sv.data());
-    httpd_socket_send(hd_, fd_, pre_event_str.c_str(), pre_event_str.size(), 0);
+    const auto chunk_size = esp32::string::snprintf("%08x", chunk_size_length, static_cast<unsigned>(frame->size() - header_size));
+    frame->replace(0, chunk_size_length, chunk_size.data(), chunk_size.size());
 
-    // Sending content chunk
-    httpd_socket_send(hd_, fd_, event_str.c_str(), event_str.size(), 0);
+    // end of chunk
+    frame->append(crlf_sv);
+    return frame;
+}
 
-    // Indicate end of chunk
-    httpd_socket_send(hd_, fd_, crlf_sv.data(), crlf_sv.length(), 0);
+// random start, so ids of a previous boot are unlikely to match the replay ring
+event_source::event_source() : next_id_((esp_random() & 0x3FFFFFFF) + 1)
+{
 }
 
 event_source::~event_source()
@@ -102,24 +219,109 @@ event_source::~event_source()
     }
 }
 
-void event_source::add_request(http_request &request)
+bool event_source::add_request(http_request &request)
 {
+    const auto last_event_id = request.get_header("Last-Event-ID");
     auto connection = new event_source_connection(*this, request);
+
     std::lock_guard<esp32::semaphore> lock(connections_mutex_);
+    expire_replay_locked();
     connections_.insert(connection);
+    return replay_locked(*connection, last_event_id);
+}
+
+bool event_source::replay_locked(event_source_connection &connection, const std::optional<std::string> &last_event_id)
+{
+    if (!last_event_id.has_value())
+    {
+        return false;
+    }
+
+    char *end = nullptr;
+    const uint32_t last_id = strtoul(last_event_id->c_str(), &end, 10);
+    if (end == last_event_id->c_str())
+    {
+        return false;
+    }
+
+    // an id not covered by the ring, older or from another boot, wraps to a large count
+    const uint32_t missed = next_id_ - 1 - last_id;
+    if (missed > replay_.size())
+    {
+        ESP_LOGD(WEBSERVER_TAG, "Last event id:%lu not in replay ring", last_id);
+        return false;
+    }
+
+    ESP_LOGI(WEBSERVER_TAG, "Replaying %lu events after id:%lu", missed, last_id);
+    for (auto iter = replay_.end() - missed; iter != replay_.end(); ++iter)
+    {
+        connection.try_send(iter->frame, iter->coalesce_key);
+    }
+    return true;
 }
 
-void event_source::try_send(const char *message, const char *event, uint32_t id, uint32_t reconnect)
+// once nobody was connected for the whole window, events were not recorded and the ring is stale
+void event_source::expire_replay_locked()
 {
-    std::set<event_source_connection *> connections_copy;
+    if (is_active_locked())
     {
-        std::lock_guard<esp32::semaphore> lock(connections_mutex_);
-        connections_copy = connections_;
+        return;
     }
 
-    for (auto *ses : connections_copy)
+    replay_.clear();
+    replay_bytes_ = 0;
+    // skip an id, so the last id a client saw never looks up to date
+    next_id_++;
+}
+
+bool event_source::is_active_locked() const
+{
+    return !connections_.empty() || (last_disconnect_ && (millis64() - last_disconnect_ < replay_window_ms));
+}
+
+bool event_source::is_active() const
+{
+    std::lock_guard<esp32::semaphore> lock(connections_mutex_);
+    return is_active_locked();
+}
+
+void event_source::try_send(const char *message, const char *event, uint32_t reconnect, uint32_t coalesce_key)
+{
+    std::lock_guard<esp32::semaphore> lock(connections_mutex_);
+    if (!is_active_locked())
+    {
+        return;
+    }
+
+    // formatted once for all connections
+    const auto frame = format_event(message ? message : "", event ? event : "", next_id_, reconnect);
+    if (!frame)
+    {
+        return;
+    }
+    next_id_++;
+
+    replay_.push_back({frame, coalesce_key});
+    replay_bytes_ += frame->size();
+    while ((replay_.size() > max_replay_events) || ((replay_bytes_ > max_replay_bytes) && (replay_.size() > 1)))
+    {
+        replay_bytes_ -= replay_.front().frame->size();
+        replay_.pop_front();
+    }
+
+    // sends never block, connections are only removed by destroy() from this same task
+    for (auto *ses : connections_)
+    {
+        ses->try_send(frame, coalesce_key);
+    }
+}
+
+void event_source::flush()
+{
+    std::lock_guard<esp32::semaphore> lock(connections_mutex_);
+    for (auto *ses : connections_)
     {
-        ses->try_send(message, event, id, reconnect);
+        ses->flush();
     }
 }
 
@@ -3,39 +3,128 @@
 #include "http_request.h"
 #include "http_response.h"
 #include "util/noncopyable.h"
+#include "util/psram_allocator.h"
 #include "util/semaphore_lockable.h"
+#include <deque>
+#include <memory>
+#include <optional>
 #include <set>
+#include <string>
+#include <string_view>
 
 namespace esp32
 {
 class event_source;
 
+// a complete http chunk, shared by all connections and the replay ring
+using event_frame_t = std::shared_ptr<const psram::string>;
+
+/**
+ * One SSE client. Frames go through a bounded queue and are written with non blocking sends,
+ * so a client with a full TCP window never blocks the httpd task. A queued frame with the same
+ * coalesce key is replaced by the newer one, else the oldest frame is dropped when the queue is full.
+ * A client that has not taken any data for max_stall_ms is disconnected.
+ * Used from the httpd task only.
+ */
 class event_source_connection : esp32::noncopyable
 {
   public:
+    static constexpr size_t max_queued_frames = 32;
+    static constexpr size_t max_queued_bytes = 16 * 1024;
+    static constexpr uint32_t max_stall_ms = 30 * 1000;
+
     event_source_connection(event_source &source, http_request &request);
 
     static void destroy(void *ptr);
-    void try_send(const std::string_view &message, const std::string_view &event, uint32_t id, uint32_t reconnect);
+
+    // frame is a complete http chunk, see event_source::format_event, coalesce_key 0 never coalesces
+    void try_send(const event_frame_t &frame, uint32_t coalesce_key);
+
+    // sends as much of the queue as the socket takes, disconnects a stalled client
+    void flush();
 
   protected:
+    struct queued_frame
+    {
+        event_frame_t frame;
+        uint32_t coalesce_key;
+    };
+
     httpd_handle_t hd_{};
     event_source &source_;
     int fd_{};
+    std::deque<queued_frame> queue_;
+    size_t queued_bytes_{0};
+    // bytes of the front frame already sent, that frame can not be dropped or replaced anymore
+    size_t front_sent_{0};
+    // time the socket first refused data, 0 if not stalled
+    uint64_t stalled_since_{0};
+    bool closing_{false};
+
+    void enqueue(const event_frame_t &frame, uint32_t coalesce_key);
+    void drop_front_unsent();
+    void close();
 };
 
+/**
+ * SSE endpoint. Events get increasing ids and the most recent ones are kept in a replay ring,
+ * so a client reconnecting with Last-Event-ID only receives what it missed.
+ * Events are still recorded for replay_window_ms after the last client left.
+ * The ring holds the whole window at the fast sampling rate(8 sensors every second), frames and ring are in PSRAM.
+ */
 class event_source : esp32::noncopyable
 {
   public:
+    static constexpr size_t max_replay_events = 512;
+    static constexpr size_t max_replay_bytes = 96 * 1024;
+    static constexpr uint32_t replay_window_ms = 60 * 1000;
+
+    event_source();
     ~event_source();
-    void add_request(http_request &request);
-    void try_send(const char *message, const char *event, uint32_t id, uint32_t reconnect);
+
+    /**
+     * Adds the client, returns true if it was brought up to date from the replay ring,
+     * false if the caller has to send the full state.
+     */
+    bool add_request(http_request &request);
+    void try_send(const char *message, const char *event, uint32_t reconnect = 0, uint32_t coalesce_key = 0);
+
+    // retries queued data of all connections, call periodically
+    void flush();
 
     size_t connection_count() const;
 
+    // true while events are sent or recorded for replay
+    bool is_active() const;
+
+    /**
+     * Formats an event as a single http chunk(size line, event, crlf), shared by all connections.
+     * Returns nullptr if there is nothing to send.
+     */
+    static event_frame_t format_event(const std::string_view &message, const std::string_view &event, uint32_t id,
+                                      uint32_t reconnect);
+
   protected:
     friend class event_source_connection;
+
+    struct replay_entry
+    {
+        event_frame_t frame;
+        uint32_t coalesce_key;
+    };
+
     std::set<event_source_connection *> connections_;
     mutable esp32::semaphore connections_mutex_;
+    // frames of ids next_id_ - replay_.size() to next_id_ - 1
+    std::deque<replay_entry, psram::allocator<replay_entry>> replay_;
+    size_t replay_bytes_{0};
+    uint32_t next_id_;
+    // time the last client left, 0 if never connected
+    uint64_t last_disconnect_{0};
+
+    // caller holds connections_mutex_
+    bool is_active_locked() const;
+    void expire_replay_locked();
+    bool replay_locked(event_source_connection &connection, const std::optional<std::string> &last_event_id);
 };
 } // namespace esp32
\ No newline at end of file
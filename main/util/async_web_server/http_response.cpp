@@ -15,8 +15,8 @@ namespace esp32
 {
 void http_response::add_common_headers()
 {
-    add_header("Connection", "close");
-    // add_header("Connection", "keep-alive");
+    // connections are kept alive, idle ones are closed by the server
+    add_header("Keep-Alive", "timeout=15");
     // add_header("Access-Control-Allow-Origin", "*");
 }
 
@@ -82,6 +82,35 @@ void array_response::send_response(esp32::http_request &request, const std::stri
     response.send_response();
 }
 
+chunked_response::chunked_response(const http_request &req, const std::string_view &content_type) : http_response(req)
+{
+    add_common_headers();
+    CHECK_THROW_ESP(httpd_resp_set_type(request_.req_, content_type.data()));
+    CHECK_THROW_ESP(httpd_resp_set_status(request_.req_, HTTPD_200));
+}
+
+chunked_response::~chunked_response()
+{
+    if (!ended_)
+    {
+        httpd_resp_send_chunk(request_.req_, nullptr, 0);
+    }
+}
+
+void chunked_response::send_chunk(const std::span<const uint8_t> &data)
+{
+    if (!data.empty())
+    {
+        CHECK_THROW_ESP(httpd_resp_send_chunk(request_.req_, reinterpret_cast<const char *>(data.data()), data.size()));
+    }
+}
+
+void chunked_response::end()
+{
+    ended_ = true;
+    CHECK_THROW_ESP(httpd_resp_send_chunk(request_.req_, nullptr, 0));
+}
+
 void fs_card_file_response::send_response()
 {
     ESP_LOGD(WEBSERVER_TAG, "Handling %s", request_.url().c_str());
@@ -49,6 +49,28 @@ class array_response final : http_response
     const bool is_gz_;
 };
 
+class chunked_response final : http_response
+{
+  public:
+    chunked_response(const http_request &req, const std::string_view &content_type);
+    ~chunked_response();
+
+    // only before the first chunk
+    using http_response::add_header;
+
+    void send_chunk(const std::span<const uint8_t> &data);
+    void send_chunk(const void *data, size_t size)
+    {
+        send_chunk({reinterpret_cast<const uint8_t *>(data), size});
+    }
+
+    // sends terminating chunk, called from destructor if not called explicitly
+    void end();
+
+  private:
+    bool ended_{false};
+};
+
 class fs_card_file_response final : http_response
 {
   public:
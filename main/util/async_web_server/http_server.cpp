@@ -2,8 +2,11 @@
 #include "http_request.h"
 #include "logging/logging_tags.h"
 #include "util/cores.h"
+#include "util/misc.h"
 #include "util/task_wrapper.h"
+#include <algorithm>
 #include <esp_log.h>
+#include <unistd.h>
 
 namespace esp32
 {
@@ -29,19 +32,121 @@ void http_server::begin()
     config.ctrl_port = 32760;
     config.core_id = esp32::http_server_core;
     config.stack_size = 6 * 1024;
-    config.lru_purge_enable = true;
+    config.max_open_sockets = max_open_sockets;
+    // httpd lru purge would close the streams first, as they never receive
+    config.lru_purge_enable = false;
+    config.open_fn = on_socket_open;
+    config.close_fn = on_socket_close;
+    config.global_user_ctx = this;
+    config.global_user_ctx_free_fn = [](void *) {};
 
     CHECK_THROW_ESP(httpd_start(&server_, &config));
+
+    idle_timer_ = std::make_unique<esp32::timer::timer>(
+        [this] {
+            httpd_queue_work(
+                server_,
+                [](void *arg) {
+                    auto p_this = static_cast<http_server *>(arg);
+                    p_this->close_idle_sockets();
+                    p_this->on_housekeeping();
+                },
+                this);
+        },
+        "http_idle");
+    idle_timer_->start_periodic(std::chrono::milliseconds(keep_alive_idle_timeout_ms / 3));
+
     ESP_LOGI(WEBSERVER_TAG, "Started web server on port:%d", port_);
 }
 
 void http_server::end()
 {
+    idle_timer_.reset();
     if (server_)
     {
         httpd_stop(server_);
         server_ = nullptr;
     }
+    sockets_.clear();
+}
+
+http_server *http_server::from_handle(httpd_handle_t hd)
+{
+    return static_cast<http_server *>(httpd_get_global_user_ctx(hd));
+}
+
+void http_server::touch_socket(httpd_req_t *req)
+{
+    auto &&sockets = from_handle(req->handle)->sockets_;
+    const auto iter = sockets.find(httpd_req_to_sockfd(req));
+    if (iter != sockets.end())
+    {
+        iter->second.last_used = millis64();
+    }
+}
+
+void http_server::mark_stream(httpd_req_t *req)
+{
+    auto &&sockets = from_handle(req->handle)->sockets_;
+    const auto iter = sockets.find(httpd_req_to_sockfd(req));
+    if (iter != sockets.end())
+    {
+        iter->second.stream = true;
+    }
+}
+
+esp_err_t http_server::on_socket_open(httpd_handle_t hd, int fd)
+{
+    auto p_this = from_handle(hd);
+    p_this->sockets_[fd] = {millis64(), false};
+    p_this->purge_sockets(fd);
+    return ESP_OK;
+}
+
+// close_fn has to close the socket itself
+void http_server::on_socket_close(httpd_handle_t hd, int fd)
+{
+    from_handle(hd)->sockets_.erase(fd);
+    close(fd);
+}
+
+void http_server::purge_sockets(int new_fd)
+{
+    const auto plain_count = std::count_if(sockets_.begin(), sockets_.end(), [](auto &&socket) { return !socket.second.stream; });
+    const bool over_budget = plain_count > (max_open_sockets - stream_reserved_sockets);
+    const bool full = sockets_.size() >= max_open_sockets;
+    if (!over_budget && !full)
+    {
+        return;
+    }
+
+    auto lru = sockets_.end();
+    for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter)
+    {
+        if (!iter->second.stream && (iter->first != new_fd) && ((lru == sockets_.end()) || (iter->second.last_used < lru->second.last_used)))
+        {
+            lru = iter;
+        }
+    }
+
+    if (lru != sockets_.end())
+    {
+        ESP_LOGD(WEBSERVER_TAG, "Closing least recently used socket:%d", lru->first);
+        httpd_sess_trigger_close(server_, lru->first);
+    }
+}
+
+void http_server::close_idle_sockets()
+{
+    const auto now = millis64();
+    for (auto &&[fd, info] : sockets_)
+    {
+        if (!info.stream && (now - info.last_used >= keep_alive_idle_timeout_ms))
+        {
+            ESP_LOGD(WEBSERVER_TAG, "Closing idle socket:%d", fd);
+            httpd_sess_trigger_close(server_, fd);
+        }
+    }
 }
 
 void http_server::add_handler(const char *url, httpd_method_t method, url_handler request_handler, const void *user_ctx)
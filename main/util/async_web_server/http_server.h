@@ -5,8 +5,11 @@
 #include "util/async_web_server/http_response.h"
 #include "util/exceptions.h"
 #include "util/noncopyable.h"
+#include "util/timer/timer.h"
 #include <esp_http_server.h>
 #include <esp_log.h>
+#include <map>
+#include <memory>
 #include <type_traits>
 #include <utility>
 
@@ -24,7 +27,18 @@ class http_server : esp32::noncopyable
     virtual void begin();
     virtual void end();
 
+    // marks the socket of the request as a long lived stream(SSE), streams are never purged and can use the reserved sockets
+    static void mark_stream(httpd_req_t *req);
+
+    // idle keep-alive connections are closed after this
+    static constexpr uint32_t keep_alive_idle_timeout_ms = 15 * 1000;
+
   protected:
+    // runs periodically on the httpd task
+    virtual void on_housekeeping()
+    {
+    }
+
     void add_handler(const char *url, httpd_method_t method, url_handler request_handler, const void *user_ctx);
 
     template <void (*ftn)(httpd_req_t *r)> void add_handler_with_exceptions(const char *url, httpd_method_t method, const void *user_ctx)
@@ -102,6 +116,7 @@ class http_server : esp32::noncopyable
 
     template <void (*url_handler)(httpd_req_t *)> static __attribute__((noinline)) esp_err_t exception_wrapper(httpd_req_t *r)
     {
+        touch_socket(r);
         try
         {
             url_handler(r);
@@ -119,6 +134,31 @@ class http_server : esp32::noncopyable
         }
     }
 
+    /**
+     * Connections are kept alive, but only max_open_sockets - stream_reserved_sockets of them can be plain requests.
+     * When a connection opens past that, or takes the last free socket, the least recently used
+     * plain connection is closed, so a new connection is always accepted and streams always have room.
+     */
+    static constexpr uint16_t max_open_sockets = 7;
+    static constexpr uint16_t stream_reserved_sockets = 2;
+
+    struct socket_info
+    {
+        uint64_t last_used;
+        bool stream;
+    };
+
+    // open sockets, only used from the httpd task
+    std::map<int, socket_info> sockets_;
+    std::unique_ptr<esp32::timer::timer> idle_timer_;
+
+    static http_server *from_handle(httpd_handle_t hd);
+    static void touch_socket(httpd_req_t *req);
+    static esp_err_t on_socket_open(httpd_handle_t hd, int fd);
+    static void on_socket_close(httpd_handle_t hd, int fd);
+    void purge_sockets(int new_fd);
+    void close_idle_sockets();
+
   private:
     const uint16_t port_{};
 
@@ -0,0 +1,280 @@
+#include "json_stream_writer.h"
+#include "http_request.h"
+#include "util/exceptions.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdio.h>
+
+namespace esp32
+{
+namespace
+{
+bool accepts_gzip(const http_request &request)
+{
+    const auto accept_encoding = request.get_header("Accept-Encoding");
+    return accept_encoding.has_value() && (accept_encoding.value().find("gzip") != std::string::npos);
+}
+} // namespace
+
+json_stream_writer::json_stream_writer(const http_request &request, const std::string_view &content_type)
+    : response_(request, content_type), accept_gzip_(accepts_gzip(request))
+{
+    response_.add_header("Vary", "Accept-Encoding");
+}
+
+void json_stream_writer::begin_object()
+{
+    begin_container('{');
+}
+
+void json_stream_writer::begin_object(std::string_view key)
+{
+    this->key(key);
+    begin_container('{');
+}
+
+void json_stream_writer::end_object()
+{
+    end_container('}');
+}
+
+void json_stream_writer::begin_array()
+{
+    begin_container('[');
+}
+
+void json_stream_writer::begin_array(std::string_view key)
+{
+    this->key(key);
+    begin_container('[');
+}
+
+void json_stream_writer::end_array()
+{
+    end_container(']');
+}
+
+void json_stream_writer::key(std::string_view key)
+{
+    begin_value();
+    write_escaped(key);
+    write(':');
+    after_key_ = true;
+}
+
+void json_stream_writer::value(std::nullptr_t)
+{
+    begin_value();
+    write("null", 4);
+}
+
+void json_stream_writer::value(bool value)
+{
+    begin_value();
+    if (value)
+    {
+        write("true", 4);
+    }
+    else
+    {
+        write("false", 5);
+    }
+}
+
+// rounded to 7 significant digits for display, the same float may not read back,
+// but sensor values rounded to 0.1 come out as 23.2 rather than 23.2000008
+void json_stream_writer::value(float value)
+{
+    write_number(value, 7);
+}
+
+void json_stream_writer::value(double value)
+{
+    write_number(value, 15);
+}
+
+void json_stream_writer::value(std::string_view value)
+{
+    begin_value();
+    write_escaped(value);
+}
+
+void json_stream_writer::end()
+{
+    flush(true);
+    if (gzip_)
+    {
+        gzip_->finish();
+    }
+    response_.end();
+}
+
+// writes the separator if the current container already has an item
+void json_stream_writer::begin_value()
+{
+    if (after_key_)
+    {
+        after_key_ = false;
+        return;
+    }
+
+    if (depth_)
+    {
+        const uint32_t bit = 1u << (depth_ - 1);
+        if (has_items_ & bit)
+        {
+            write(',');
+        }
+        has_items_ |= bit;
+    }
+}
+
+void json_stream_writer::begin_container(char open)
+{
+    if (depth_ >= max_depth)
+    {
+        CHECK_THROW_ESP(ESP_ERR_INVALID_STATE);
+    }
+
+    begin_value();
+    write(open);
+    depth_++;
+    has_items_ &= ~(1u << (depth_ - 1));
+}
+
+void json_stream_writer::end_container(char close)
+{
+    if (!depth_)
+    {
+        CHECK_THROW_ESP(ESP_ERR_INVALID_STATE);
+    }
+
+    depth_--;
+    write(close);
+}
+
+void json_stream_writer::write_integer(int64_t value)
+{
+    begin_value();
+    char str[24];
+    const auto result = std::to_chars(str, str + sizeof(str), value);
+    write(str, result.ptr - str);
+}
+
+void json_stream_writer::write_integer(uint64_t value)
+{
+    begin_value();
+    char str[24];
+    const auto result = std::to_chars(str, str + sizeof(str), value);
+    write(str, result.ptr - str);
+}
+
+void json_stream_writer::write_number(double number, int precision)
+{
+    if (!std::isfinite(number))
+    {
+        value(nullptr);
+        return;
+    }
+
+    begin_value();
+    char str[32];
+    const auto length = snprintf(str, sizeof(str), "%.*g", precision, number);
+    write(str, std::min<size_t>(length, sizeof(str) - 1));
+}
+
+void json_stream_writer::write_escaped(std::string_view value)
+{
+    write('"');
+
+    // runs without special characters are copied as is
+    size_t run_start = 0;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        const auto c = static_cast<uint8_t>(value[i]);
+        if ((c >= 0x20) && (c != '"') && (c != '\\'))
+        {
+            continue;
+        }
+
+        write(value.data() + run_start, i - run_start);
+        run_start = i + 1;
+
+        switch (c)
+        {
+        case '"':
+            write("\\\"", 2);
+            break;
+        case '\\':
+            write("\\\\", 2);
+            break;
+        case '\n':
+            write("\\n", 2);
+            break;
+        case '\r':
+            write("\\r", 2);
+            break;
+        case '\t':
+            write("\\t", 2);
+            break;
+        default: {
+            char str[8];
+            snprintf(str, sizeof(str), "\\u%04x", c);
+            write(str, 6);
+            break;
+        }
+        }
+    }
+    write(value.data() + run_start, value.size() - run_start);
+
+    write('"');
+}
+
+void json_stream_writer::write(const char *data, size_t size)
+{
+    while (size)
+    {
+        if (used_ == buffer_.size())
+        {
+            flush();
+        }
+
+        const auto count = std::min(size, buffer_.size() - used_);
+        memcpy(buffer_.data() + used_, data, count);
+        used_ += count;
+        data += count;
+        size -= count;
+    }
+}
+
+// the encoding is decided at the first flush, when the headers are still unsent
+void json_stream_writer::flush(bool last)
+{
+    if (!started_)
+    {
+        started_ = true;
+        if (accept_gzip_ && !last)
+        {
+            // while another response holds the compressor, this one goes out as is
+            gzip_ = gzip_encoder::try_create([this](std::span<const uint8_t> data) { response_.send_chunk(data); });
+            if (gzip_)
+            {
+                response_.add_header("Content-Encoding", "gzip");
+            }
+        }
+    }
+
+    if (gzip_)
+    {
+        gzip_->write({reinterpret_cast<const uint8_t *>(buffer_.data()), used_});
+    }
+    else
+    {
+        response_.send_chunk(buffer_.data(), used_);
+    }
+    used_ = 0;
+}
+
+} // namespace esp32
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "http_response.h"
+#include "util/gzip_encoder.h"
+#include "util/noncopyable.h"
+#include <array>
+#include <concepts>
+#include <memory>
+#include <stdint.h>
+#include <string_view>
+
+namespace esp32
+{
+/**
+ * Writes JSON straight into a chunked response through a small fixed buffer, flushed as a chunk when full.
+ * There is no document in between, so the response size is not limited by a guessed capacity.
+ * Nesting is tracked only for the separators, the caller is responsible for a well formed structure.
+ * Non finite numbers are written as null.
+ * If the client accepts gzip and the JSON outgrows the buffer, the response is compressed on the fly,
+ * smaller responses are not worth the compressor setup and go out as is, as do responses while the compressor is busy.
+ */
+class json_stream_writer final : esp32::noncopyable
+{
+  public:
+    static constexpr size_t buffer_size = 512;
+    static constexpr uint8_t max_depth = 32;
+
+    json_stream_writer(const http_request &request, const std::string_view &content_type);
+
+    void begin_object();
+    void begin_object(std::string_view key);
+    void end_object();
+    void begin_array();
+    void begin_array(std::string_view key);
+    void end_array();
+
+    void key(std::string_view key);
+
+    void value(std::nullptr_t);
+    void value(bool value);
+    void value(float value);
+    void value(double value);
+    void value(std::string_view value);
+    void value(const char *value)
+    {
+        this->value(std::string_view(value));
+    }
+    template <std::integral T> void value(T value)
+    {
+        if constexpr (std::is_signed_v<T>)
+        {
+            write_integer(static_cast<int64_t>(value));
+        }
+        else
+        {
+            write_integer(static_cast<uint64_t>(value));
+        }
+    }
+
+    template <class T> void member(std::string_view key, const T &value)
+    {
+        this->key(key);
+        this->value(value);
+    }
+
+    // flushes the buffer and sends the terminating chunk
+    void end();
+
+  private:
+    chunked_response response_;
+    std::array<char, buffer_size> buffer_;
+    size_t used_{0};
+    const bool accept_gzip_;
+    bool started_{false};
+    std::unique_ptr<gzip_encoder> gzip_;
+    uint8_t depth_{0};
+    // bit per nesting level, set once the container has an item
+    uint32_t has_items_{0};
+    bool after_key_{false};
+
+    void begin_value();
+    void begin_container(char open);
+    void end_container(char close);
+    void write_integer(int64_t value);
+    void write_integer(uint64_t value);
+    void write_number(double number, int precision);
+    void write_escaped(std::string_view value);
+    void write(const char *data, size_t size);
+    void write(char c)
+    {
+        if (used_ == buffer_.size())
+        {
+            flush();
+        }
+        buffer_[used_++] = c;
+    }
+    void flush(bool last = false);
+};
+
+} // namespace esp32
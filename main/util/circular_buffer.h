@@ -1,8 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <compare>
+#include <iterator>
+#include <span>
 #include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
+#include <utility>
 
 template <typename T, size_t S, typename IT = size_t>
     requires std::is_trivially_copyable_v<T>
@@ -20,6 +25,118 @@ class circular_buffer
      */
     using index_t = IT;
 
+    /**
+     * Power of two capacities wrap indexes with a mask instead of a compare.
+     */
+    static constexpr bool is_power_of_two = (S != 0) && ((S & (S - 1)) == 0);
+
+    /**
+     * Random access iterator from the first to the last element.
+     */
+    class const_iterator
+    {
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return buffer_->element(index_);
+        }
+
+        pointer operator->() const
+        {
+            return &buffer_->element(index_);
+        }
+
+        reference operator[](difference_type n) const
+        {
+            return buffer_->element(index_ + n);
+        }
+
+        const_iterator &operator++()
+        {
+            ++index_;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto result = *this;
+            ++index_;
+            return result;
+        }
+
+        const_iterator &operator--()
+        {
+            --index_;
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            auto result = *this;
+            --index_;
+            return result;
+        }
+
+        const_iterator &operator+=(difference_type n)
+        {
+            index_ += n;
+            return *this;
+        }
+
+        const_iterator &operator-=(difference_type n)
+        {
+            index_ -= n;
+            return *this;
+        }
+
+        friend const_iterator operator+(const_iterator it, difference_type n)
+        {
+            return it += n;
+        }
+
+        friend const_iterator operator+(difference_type n, const_iterator it)
+        {
+            return it += n;
+        }
+
+        friend const_iterator operator-(const_iterator it, difference_type n)
+        {
+            return it -= n;
+        }
+
+        friend difference_type operator-(const const_iterator &a, const const_iterator &b)
+        {
+            return a.index_ - b.index_;
+        }
+
+        friend bool operator==(const const_iterator &a, const const_iterator &b)
+        {
+            return a.index_ == b.index_;
+        }
+
+        friend std::strong_ordering operator<=>(const const_iterator &a, const const_iterator &b)
+        {
+            return a.index_ <=> b.index_;
+        }
+
+      private:
+        friend class circular_buffer;
+        const_iterator(const circular_buffer *buffer, difference_type index) : buffer_(buffer), index_(index)
+        {
+        }
+
+        const circular_buffer *buffer_{};
+        difference_type index_{};
+    };
+
     constexpr circular_buffer();
 
     /**
@@ -78,6 +195,30 @@ class circular_buffer
      */
     T operator[](IT index) const;
 
+    /**
+     * Iterators over the elements, first to last.
+     */
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, count_);
+    }
+
+    /**
+     * Returns the elements as two contiguous segments, first to last.
+     * The second segment is empty unless the elements wrap around the end of the storage.
+     */
+    std::pair<std::span<const T>, std::span<const T>> as_spans() const;
+
+    /**
+     * Same as as_spans() for count elements starting at index, index + count <= size.
+     */
+    std::pair<std::span<const T>, std::span<const T>> as_spans(IT index, IT count) const;
+
     /**
      * Returns how many elements are actually stored in the buffer.
      */
@@ -109,6 +250,25 @@ class circular_buffer
     T *head_{};
     T *tail_{};
     IT count_{};
+
+    // storage offset of the element at index, index < capacity
+    size_t offset(size_t index) const
+    {
+        const size_t position = (head_ - buffer_) + index;
+        if constexpr (is_power_of_two)
+        {
+            return position & (S - 1);
+        }
+        else
+        {
+            return position < S ? position : position - S;
+        }
+    }
+
+    const T &element(size_t index) const
+    {
+        return buffer_[offset(index)];
+    }
 };
 
 template <typename T, size_t S, typename IT> constexpr circular_buffer<T, S, IT>::circular_buffer() : head_(buffer_), tail_(buffer_), count_(0)
@@ -205,7 +365,25 @@ template <typename T, size_t S, typename IT> T circular_buffer<T, S, IT>::operat
 {
     if (index >= count_)
         return *tail_;
-    return *(buffer_ + ((head_ - buffer_ + index) % capacity));
+    return element(index);
+}
+
+template <typename T, size_t S, typename IT>
+std::pair<std::span<const T>, std::span<const T>> circular_buffer<T, S, IT>::as_spans() const
+{
+    return as_spans(0, count_);
+}
+
+template <typename T, size_t S, typename IT>
+std::pair<std::span<const T>, std::span<const T>> circular_buffer<T, S, IT>::as_spans(IT index, IT count) const
+{
+    if (!count)
+    {
+        return {};
+    }
+    const size_t start = offset(index);
+    const size_t first_size = std::min<size_t>(count, S - start);
+    return {std::span<const T>(buffer_ + start, first_size), std::span<const T>(buffer_, count - first_size)};
 }
 
 template <typename T, size_t S, typename IT> IT inline circular_buffer<T, S, IT>::size() const
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "util/misc.h"
+#include "util/noncopyable.h"
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace esp32
+{
+/**
+ * Runs periodic jobs from a single task, which sleeps until the earliest deadline.
+ * Jobs are kept in a min-heap on their next deadline. Not thread safe, use from the owning task only.
+ */
+class deadline_scheduler : esp32::noncopyable
+{
+  public:
+    using callback_t = std::function<void(void)>;
+    // returns the milliseconds until the next run
+    using adaptive_callback_t = std::function<uint32_t(void)>;
+    using job_id_t = uint32_t;
+
+    /**
+     * Adds a job that runs first after initial_delay_ms and then every interval_ms.
+     */
+    job_id_t add(uint32_t interval_ms, const callback_t &callback, uint32_t initial_delay_ms = 0)
+    {
+        configASSERT(interval_ms);
+        return add_adaptive(
+            [interval_ms, callback] {
+                callback();
+                return interval_ms;
+            },
+            initial_delay_ms);
+    }
+
+    /**
+     * Adds a job that runs first after initial_delay_ms and then picks its own interval on every run.
+     */
+    job_id_t add_adaptive(const adaptive_callback_t &callback, uint32_t initial_delay_ms = 0)
+    {
+        const auto id = next_id_++;
+        jobs_.push_back({millis64() + initial_delay_ms, id, callback});
+        std::push_heap(jobs_.begin(), jobs_.end(), later);
+        return id;
+    }
+
+    /**
+     * Moves the next run of a job to delay_ms from now, the job keeps this phase afterwards.
+     * Not to be called from a job callback, the heap is being updated while jobs run.
+     */
+    void reschedule(job_id_t id, uint32_t delay_ms)
+    {
+        const auto iter = std::find_if(jobs_.begin(), jobs_.end(), [id](const job &j) { return j.id == id; });
+        if (iter != jobs_.end())
+        {
+            iter->deadline = millis64() + delay_ms;
+            std::make_heap(jobs_.begin(), jobs_.end(), later);
+        }
+    }
+
+    /**
+     * Runs all due jobs and returns the milliseconds until the next deadline.
+     */
+    uint64_t run_due()
+    {
+        if (jobs_.empty())
+        {
+            return UINT32_MAX;
+        }
+
+        auto now = millis64();
+        while (jobs_.front().deadline <= now)
+        {
+            std::pop_heap(jobs_.begin(), jobs_.end(), later);
+            auto &job = jobs_.back();
+            const uint32_t interval = std::max<uint32_t>(job.callback(), 1);
+
+            // keep the phase, unless the job overran whole intervals
+            now = millis64();
+            job.deadline += interval;
+            if (job.deadline <= now)
+            {
+                job.deadline = now + interval;
+            }
+            std::push_heap(jobs_.begin(), jobs_.end(), later);
+        }
+        return jobs_.front().deadline - now;
+    }
+
+  private:
+    struct job
+    {
+        uint64_t deadline;
+        job_id_t id;
+        adaptive_callback_t callback;
+    };
+
+    std::vector<job> jobs_;
+    job_id_t next_id_{0};
+
+    static bool later(const job &a, const job &b)
+    {
+        return a.deadline > b.deadline;
+    }
+};
+} // namespace esp32
@@ -0,0 +1,118 @@
+#include "util/gzip_encoder.h"
+#include "util/exceptions.h"
+#include <array>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <miniz.h>
+
+namespace esp32
+{
+namespace
+{
+// same as zlib level 1, greedy parsing with a single probe
+constexpr int compress_flags = 1 | TDEFL_GREEDY_PARSING_FLAG;
+
+// magic, deflate, no flags, no mtime, no extra flags, unix
+constexpr std::array<uint8_t, 10> gzip_header{0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+} // namespace
+
+struct gzip_encoder::state
+{
+    tdefl_compressor compressor;
+    std::array<uint8_t, 1024> output;
+};
+
+gzip_encoder::state *gzip_encoder::shared_state_ = nullptr;
+std::atomic_bool gzip_encoder::shared_state_in_use_{false};
+
+void gzip_encoder::release_state::operator()(state *) const
+{
+    shared_state_in_use_.store(false);
+}
+
+std::unique_ptr<gzip_encoder> gzip_encoder::try_create(const sink_t &sink)
+{
+    bool expected = false;
+    if (!shared_state_in_use_.compare_exchange_strong(expected, true))
+    {
+        return nullptr;
+    }
+
+    // allocated once, only by the holder of the state
+    if (!shared_state_)
+    {
+        shared_state_ = static_cast<state *>(heap_caps_malloc(sizeof(state), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    }
+
+    if (!shared_state_ || (tdefl_init(&shared_state_->compressor, nullptr, nullptr, compress_flags) != TDEFL_STATUS_OKAY))
+    {
+        shared_state_in_use_.store(false);
+        return nullptr;
+    }
+
+    return std::unique_ptr<gzip_encoder>(new gzip_encoder(sink, shared_state_));
+}
+
+void gzip_encoder::write(std::span<const uint8_t> data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+
+    crc_ = esp_rom_crc32_le(crc_, data.data(), data.size());
+    input_size_ += data.size();
+    compress(data, false);
+}
+
+void gzip_encoder::finish()
+{
+    compress({}, true);
+
+    // crc and size of the input, little endian
+    std::array<uint8_t, 8> trailer;
+    for (size_t i = 0; i < 4; i++)
+    {
+        trailer[i] = static_cast<uint8_t>(crc_ >> (8 * i));
+        trailer[4 + i] = static_cast<uint8_t>(input_size_ >> (8 * i));
+    }
+    sink_(trailer);
+}
+
+void gzip_encoder::compress(std::span<const uint8_t> data, bool finish)
+{
+    // written with the first output, so the caller can still set the headers after creating the encoder
+    if (!header_written_)
+    {
+        header_written_ = true;
+        sink_(gzip_header);
+    }
+
+    auto &output = state_->output;
+    const auto flush = finish ? TDEFL_FINISH : TDEFL_NO_FLUSH;
+
+    // without finish the compressor may keep output pending, it comes out with the next call
+    while (true)
+    {
+        size_t in_size = data.size();
+        size_t out_size = output.size();
+        const auto status = tdefl_compress(&state_->compressor, data.data(), &in_size, output.data(), &out_size, flush);
+        if ((status != TDEFL_STATUS_OKAY) && (status != TDEFL_STATUS_DONE))
+        {
+            CHECK_THROW_ESP(ESP_FAIL);
+        }
+
+        data = data.subspan(in_size);
+        if (out_size)
+        {
+            sink_({output.data(), out_size});
+        }
+
+        if (finish ? (status == TDEFL_STATUS_DONE) : data.empty())
+        {
+            break;
+        }
+    }
+}
+
+} // namespace esp32
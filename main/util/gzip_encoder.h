@@ -0,0 +1,59 @@
+#pragma once
+
+#include "util/noncopyable.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdint.h>
+
+namespace esp32
+{
+/**
+ * Streaming gzip compression with the deflate of the ROM miniz, output is passed to the sink as it is produced.
+ * The compressor state is large, there is a single one allocated from PSRAM on first use and kept,
+ * an encoder holds it for its life, so only one response is compressed at a time.
+ * Uses a single probe, dynamic responses are compressed on the fly on the httpd task and speed matters more than ratio.
+ */
+class gzip_encoder final : esp32::noncopyable
+{
+  public:
+    using sink_t = std::function<void(std::span<const uint8_t>)>;
+
+    // returns nullptr if the compressor is in use or could not be allocated, the data has to go out uncompressed
+    static std::unique_ptr<gzip_encoder> try_create(const sink_t &sink);
+
+    void write(std::span<const uint8_t> data);
+
+    // flushes the compressor and writes the gzip trailer
+    void finish();
+
+    size_t get_input_size() const
+    {
+        return input_size_;
+    }
+
+  private:
+    struct state;
+    struct release_state
+    {
+        void operator()(state *) const;
+    };
+
+    static state *shared_state_;
+    static std::atomic_bool shared_state_in_use_;
+
+    const sink_t sink_;
+    const std::unique_ptr<state, release_state> state_;
+    bool header_written_{false};
+    uint32_t crc_{0};
+    size_t input_size_{0};
+
+    gzip_encoder(const sink_t &sink, state *state) : sink_(sink), state_(state)
+    {
+    }
+
+    void compress(std::span<const uint8_t> data, bool finish);
+};
+
+} // namespace esp32
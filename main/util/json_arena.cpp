@@ -0,0 +1,83 @@
+#include "util/json_arena.h"
+#include "util/exceptions.h"
+#include "util/helper.h"
+#include <esp_heap_caps.h>
+
+namespace esp32
+{
+json_arena_pool json_arena_pool::instance;
+
+size_t json_arena_pool::acquire(char *&buffer)
+{
+    uses_++;
+    for (size_t i = 0; i < arenas_.size(); i++)
+    {
+        auto &arena = arenas_[i];
+        bool expected = false;
+        if (!arena.in_use.compare_exchange_strong(expected, true))
+        {
+            continue;
+        }
+
+        // allocated once, only by the holder of the arena
+        if (!arena.buffer)
+        {
+            arena.buffer = static_cast<char *>(heap_caps_malloc(arena_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+            if (!arena.buffer)
+            {
+                arena.in_use = false;
+                CHECK_THROW_ESP(ESP_ERR_NO_MEM);
+            }
+        }
+
+        buffer = arena.buffer;
+        return i;
+    }
+
+    fallbacks_++;
+    buffer = static_cast<char *>(heap_caps_malloc(arena_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    if (!buffer)
+    {
+        CHECK_THROW_ESP(ESP_ERR_NO_MEM);
+    }
+    return arena_count;
+}
+
+void json_arena_pool::record_use(size_t memory_usage, bool overflowed)
+{
+    auto high_water = high_water_.load();
+    while ((memory_usage > high_water) && !high_water_.compare_exchange_weak(high_water, memory_usage))
+    {
+    }
+
+    if (overflowed)
+    {
+        overflows_++;
+    }
+}
+
+void json_arena_pool::release(size_t index, char *buffer)
+{
+    if (index < arenas_.size())
+    {
+        arenas_[index].in_use = false;
+    }
+    else
+    {
+        heap_caps_free(buffer);
+    }
+}
+
+json_arena_pool::stats json_arena_pool::get_stats() const
+{
+    return {high_water_.load(), uses_.load(), fallbacks_.load(), overflows_.load()};
+}
+
+std::string json_arena_pool::get_stats_str() const
+{
+    const auto stats = get_stats();
+    return esp32::string::sprintf("%u/%u bytes max, %lu uses, %lu fallbacks, %lu overflows", stats.high_water, arena_size, stats.uses,
+                                  stats.fallbacks, stats.overflows);
+}
+
+} // namespace esp32
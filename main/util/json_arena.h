@@ -0,0 +1,99 @@
+#pragma once
+
+#include "util/arduino_json_helper.h"
+#include "util/noncopyable.h"
+#include <array>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+namespace esp32
+{
+class json_arena_lease;
+class json_arena_document;
+
+/**
+ * Reusable memory for ArduinoJson documents on hot paths, like the SSE sensor events.
+ * Each arena is a PSRAM block allocated on first use and kept, a document borrows a free one
+ * and gives it back reset, instead of a malloc and free for every document.
+ * There is an arena per task that builds documents concurrently, if all are busy
+ * a document falls back to its own allocation, which shows up in the stats.
+ */
+class json_arena_pool final : esp32::noncopyable
+{
+  public:
+    static constexpr size_t arena_count = 2;
+    static constexpr size_t arena_size = 2048;
+
+    struct stats
+    {
+        // largest memory usage of a document
+        size_t high_water;
+        uint32_t uses;
+        uint32_t fallbacks;
+        uint32_t overflows;
+    };
+
+    static json_arena_pool instance;
+
+    stats get_stats() const;
+    std::string get_stats_str() const;
+
+  private:
+    friend class json_arena_lease;
+    friend class json_arena_document;
+
+    struct arena
+    {
+        std::atomic_bool in_use{false};
+        char *buffer{nullptr};
+    };
+
+    std::array<arena, arena_count> arenas_;
+    std::atomic<size_t> high_water_{0};
+    std::atomic<uint32_t> uses_{0};
+    std::atomic<uint32_t> fallbacks_{0};
+    std::atomic<uint32_t> overflows_{0};
+
+    json_arena_pool() = default;
+
+    // returns the arena index, arena_count if none was free and buffer is a fallback allocation
+    size_t acquire(char *&buffer);
+    void release(size_t index, char *buffer);
+    void record_use(size_t memory_usage, bool overflowed);
+};
+
+// a borrowed arena, a base class so it is acquired before the document is constructed on it
+class json_arena_lease : esp32::noncopyable
+{
+  protected:
+    json_arena_lease() : index_(json_arena_pool::instance.acquire(buffer_))
+    {
+    }
+
+    ~json_arena_lease()
+    {
+        json_arena_pool::instance.release(index_, buffer_);
+    }
+
+    char *buffer_;
+    const size_t index_;
+};
+
+/**
+ * Json document of arena_size capacity backed by the arena pool, the arena is returned on destruction.
+ */
+class json_arena_document final : private json_arena_lease, public JsonDocument
+{
+  public:
+    json_arena_document() : JsonDocument(buffer_, json_arena_pool::arena_size)
+    {
+    }
+
+    ~json_arena_document()
+    {
+        json_arena_pool::instance.record_use(memoryUsage(), overflowed());
+    }
+};
+
+} // namespace esp32
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <stdint.h>
 #include <esp_timer.h>
 
 namespace esp32
@@ -10,6 +11,12 @@ __attribute__((unused)) static inline unsigned long millis(void)
     return (unsigned long)(esp_timer_get_time() / 1000ULL);
 }
 
+// does not wrap, unlike millis() after 49.7 days
+__attribute__((unused)) static inline uint64_t millis64(void)
+{
+    return esp_timer_get_time() / 1000ULL;
+}
+
 __attribute__((unused)) static inline float round_with_precision(float value, float precision)
 {
     return (!std::isnan(value)) ? std::round(value / precision) * precision : value;
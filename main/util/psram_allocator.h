@@ -21,6 +21,11 @@ template <typename T> class allocator
     allocator() = default;
     ~allocator() = default;
 
+    // rebound copies, for containers and allocate_shared that allocate their own node types
+    template <class U> allocator(const allocator<U> &)
+    {
+    }
+
     template <class U> struct rebind
     {
         typedef allocator<U> other;
@@ -58,6 +63,11 @@ template <typename T> class allocator
     {
         p->~T();
     }
+
+    template <class U> bool operator==(const allocator<U> &) const
+    {
+        return true;
+    }
 };
 
 struct deleter
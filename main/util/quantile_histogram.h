@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stdint.h>
+
+/**
+ * Constant memory quantile estimator for a sliding window of integer values.
+ * Values are counted in binsT equal width bins over [min, max], values outside are counted in the edge bins.
+ * Values leaving the window must be removed with the same value they were added with.
+ */
+template <uint16_t binsT> class quantile_histogram
+{
+  public:
+    static constexpr uint16_t bins = binsT;
+
+    void set_range(int32_t min, int32_t max)
+    {
+        min_ = min;
+        bin_width_ = std::max<int32_t>(1, (max - min + binsT - 1) / binsT);
+        clear();
+    }
+
+    void add(int32_t value)
+    {
+        counts_[bin(value)]++;
+        total_++;
+    }
+
+    void remove(int32_t value)
+    {
+        auto &count = counts_[bin(value)];
+        if (count)
+        {
+            count--;
+            total_--;
+        }
+    }
+
+    void clear()
+    {
+        counts_.fill(0);
+        total_ = 0;
+    }
+
+    uint32_t size() const
+    {
+        return total_;
+    }
+
+    /**
+     * Returns the estimated value at quantile q(0-1), interpolated inside the bin.
+     */
+    std::optional<float> quantile(float q) const
+    {
+        if (!total_)
+        {
+            return std::nullopt;
+        }
+
+        const float rank = std::clamp<float>(q, 0, 1) * (total_ - 1);
+        uint32_t before = 0;
+        for (uint16_t i = 0; i < binsT; i++)
+        {
+            const auto count = counts_[i];
+            if (count && (rank < before + count))
+            {
+                const float fraction = (rank - before + 0.5f) / count;
+                return min_ + (i + fraction) * bin_width_;
+            }
+            before += count;
+        }
+        return min_ + static_cast<float>(binsT) * bin_width_;
+    }
+
+  private:
+    std::array<uint16_t, binsT> counts_{};
+    uint32_t total_{};
+    int32_t min_{};
+    int32_t bin_width_{1};
+
+    uint16_t bin(int32_t value) const
+    {
+        return static_cast<uint16_t>(std::clamp<int32_t>((value - min_) / bin_width_, 0, binsT - 1));
+    }
+};
@@ -0,0 +1,105 @@
+#include "web_server/session_table.h"
+
+#include "util/helper.h"
+#include "util/misc.h"
+#include <algorithm>
+#include <esp_random.h>
+#include <mutex>
+
+namespace
+{
+// no early exit, time does not depend on where the first difference is
+bool constant_time_equals(std::string_view a, const std::array<char, session_table::token_length> &b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    uint8_t difference = 0;
+    for (size_t i = 0; i < b.size(); i++)
+    {
+        difference |= static_cast<uint8_t>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+}
+} // namespace
+
+std::string session_table::create(const std::string &client_address)
+{
+    std::array<uint8_t, token_length / 2> random;
+    esp_fill_random(random.data(), random.size());
+    const auto token = esp32::format_hex(random.data(), random.size());
+
+    std::lock_guard<esp32::semaphore> lock(data_mutex_);
+    const auto now = esp32::millis64();
+
+    // a free or expired slot, else the least recently used one
+    auto slot = std::min_element(sessions_.begin(), sessions_.end(), [now](const session &a, const session &b) {
+        const auto a_live = a.in_use && (now - a.last_used < session_timeout_ms);
+        const auto b_live = b.in_use && (now - b.last_used < session_timeout_ms);
+        if (a_live != b_live)
+        {
+            return !a_live;
+        }
+        return a.last_used < b.last_used;
+    });
+
+    std::copy_n(token.begin(), token_length, slot->token.begin());
+    slot->client_address = client_address;
+    slot->last_used = now;
+    slot->in_use = true;
+    return token;
+}
+
+std::optional<size_t> session_table::find(std::string_view token, uint64_t now)
+{
+    // every slot is compared, so the time does not tell which one matched
+    std::optional<size_t> found;
+    for (size_t i = 0; i < sessions_.size(); i++)
+    {
+        const auto &session = sessions_[i];
+        const bool match = constant_time_equals(token, session.token);
+        if (match && session.in_use && (now - session.last_used < session_timeout_ms))
+        {
+            found = i;
+        }
+    }
+    return found;
+}
+
+bool session_table::validate(std::string_view token, const std::string &client_address)
+{
+    std::lock_guard<esp32::semaphore> lock(data_mutex_);
+    const auto now = esp32::millis64();
+    const auto slot = find(token, now);
+    if (!slot)
+    {
+        return false;
+    }
+
+    auto &session = sessions_[*slot];
+    if (session.client_address != client_address)
+    {
+        return false;
+    }
+
+    session.last_used = now;
+    return true;
+}
+
+void session_table::remove(std::string_view token)
+{
+    std::lock_guard<esp32::semaphore> lock(data_mutex_);
+    const auto slot = find(token, esp32::millis64());
+    if (slot)
+    {
+        sessions_[*slot] = {};
+    }
+}
+
+void session_table::clear()
+{
+    std::lock_guard<esp32::semaphore> lock(data_mutex_);
+    sessions_.fill({});
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "util/noncopyable.h"
+#include "util/semaphore_lockable.h"
+#include <array>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+/**
+ * Logged in web sessions, kept in memory only, so a reboot logs everyone out.
+ * Tokens are random and bound to the client address they were issued to.
+ * A lookup scans the few slots with a constant time compare, there is no hashing or NVS access per request.
+ */
+class session_table final : esp32::noncopyable
+{
+  public:
+    static constexpr size_t token_length = 32;
+    static constexpr size_t max_sessions = 8;
+    // idle time after which a session is dropped, every use extends it
+    static constexpr uint64_t session_timeout_ms = 7ull * 24 * 60 * 60 * 1000;
+
+    /**
+     * Creates a session, returns its token. The least recently used session is dropped if the table is full.
+     */
+    std::string create(const std::string &client_address);
+
+    /**
+     * Returns true if token is a live session of client_address.
+     */
+    bool validate(std::string_view token, const std::string &client_address);
+
+    void remove(std::string_view token);
+
+    // drops all sessions, for example after the credentials changed
+    void clear();
+
+  private:
+    struct session
+    {
+        std::array<char, token_length> token;
+        std::string client_address;
+        uint64_t last_used;
+        bool in_use;
+    };
+
+    esp32::semaphore data_mutex_;
+    std::array<session, max_sessions> sessions_{};
+
+    // caller holds data_mutex_, returns the slot of the live session with token
+    std::optional<size_t> find(std::string_view token, uint64_t now);
+};
@@ -16,15 +16,16 @@
 #include "util/arduino_json_helper.h"
 #include "util/async_web_server/http_request.h"
 #include "util/async_web_server/http_response.h"
+#include "util/async_web_server/json_stream_writer.h"
 #include "util/filesystem/file.h"
 #include "util/filesystem/file_info.h"
 #include "util/filesystem/filesystem.h"
 #include "util/finally.h"
 #include "util/hash/hash.h"
 #include "util/helper.h"
+#include "util/json_arena.h"
 #include "util/misc.h"
 #include "util/ota.h"
-#include "util/psram_allocator.h"
 #include <dirent.h>
 #include <esp_log.h>
 #include <filesystem>
@@ -34,12 +35,14 @@
 #include <sys/types.h>
 
 static const char json_media_type[] = "application/json";
+static const char binary_media_type[] = "application/octet-stream";
 static const char js_media_type[] = "text/javascript";
 static const char html_media_type[] = "text/html";
 static const char css_media_type[] = "text/css";
 static const char png_media_type[] = "image/png";
 
 static const char CookieHeader[] = "Cookie";
+static const char AcceptHeader[] = "Accept";
 static const char AuthCookieName[] = "ESPSESSIONID=";
 
 // Web url
@@ -55,15 +58,35 @@ static constexpr char login_url[] = "/login.html";
 static constexpr char index_url[] = "/index.html";
 static constexpr char debug_url[] = "/debug.html";
 
-std::string create_hash(const credentials &cred, const std::string &host)
-{
-    esp32::hash::hash<MBEDTLS_MD_SHA256> hasher;
-    hasher.update(cred.get_user_name());
-    hasher.update(cred.get_password());
-    hasher.update(host);
-    auto result = hasher.finish();
-    return esp32::format_hex(result);
-}
+// Binary history response, little endian header followed by count int16 values
+// and, if history_binary_has_positions is set, count uint32 entry sequences.
+// value = raw * 10^exponent, gap(missing read) is INT16_MIN.
+constexpr std::array<char, 4> history_binary_magic{'S', 'H', 'I', 'S'};
+constexpr uint8_t history_binary_version = 2;
+constexpr uint8_t history_binary_has_positions = 0x01;
+
+struct __attribute__((packed)) history_binary_header
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t sensor_id;
+    int8_t exponent;
+    uint8_t flags;
+    uint32_t first;
+    uint32_t start;
+    uint32_t cursor;
+    uint32_t interval;
+    uint32_t age;
+    int16_t mean;
+    int16_t min;
+    int16_t max;
+    int16_t p50;
+    int16_t p90;
+    int16_t p99;
+    uint16_t count;
+};
+
+static_assert(sizeof(history_binary_header) == 42);
 
 template <const uint8_t data[], const auto len, const char *sha256> void web_server::handle_array_page_with_auth(esp32::http_request &request)
 {
@@ -140,13 +163,6 @@ bool web_server::check_authenticated(esp32::http_request &request)
     return true;
 }
 
-template <class Array, class K, class T> void web_server::add_key_value_object(Array &array, const K &key, const T &value)
-{
-    auto j1 = array.createNestedObject();
-    j1[("key")] = key;
-    j1[("value")] = value;
-}
-
 void web_server::handle_information_get(esp32::http_request &request)
 {
     ESP_LOGD(WEBSERVER_TAG, "/api/information/get");
@@ -166,25 +182,27 @@ void web_server::handle_sensor_get(esp32::http_request &request)
         return;
     }
 
-    BasicJsonDocument<esp32::psram::json_allocator> json_document(2048);
-    JsonArray array = json_document.to<JsonArray>();
+    esp32::json_stream_writer json(request, js_media_type);
+    json.begin_array();
 
     for (auto i = 0; i < total_sensors; i++)
     {
         const auto id = static_cast<sensor_id_index>(i);
         const auto &sensor = ui_interface_.get_sensor(id);
         const auto value = sensor.get_value();
-        auto obj = array.createNestedObject();
 
         auto &&definition = get_sensor_definition(id);
-        obj["value"] = value;
-        obj["id"] = static_cast<uint8_t>(id);
-        obj["unit"] = definition.get_unit();
-        obj["type"] = definition.get_name();
-        obj["level"] = static_cast<uint64_t>(definition.calculate_level(value));
+        json.begin_object();
+        json.member("value", value);
+        json.member("id", static_cast<uint8_t>(id));
+        json.member("unit", definition.get_unit());
+        json.member("type", definition.get_name());
+        json.member("level", static_cast<uint64_t>(definition.calculate_level(value)));
+        json.end_object();
     }
 
-    send_json_response(request, json_document);
+    json.end_array();
+    json.end();
 }
 
 void web_server::handle_sensor_stats(esp32::http_request &request)
@@ -195,8 +213,10 @@ void web_server::handle_sensor_stats(esp32::http_request &request)
         return;
     }
 
-    const auto arguments = request.get_url_arguments({"id"});
+    const auto arguments = request.get_url_arguments({"id", "since", "points"});
     auto &&id_arg = arguments[0];
+    auto &&since_arg = arguments[1];
+    auto &&points_arg = arguments[2];
 
     auto id_arg_num = id_arg.has_value() ? esp32::string::parse_number<uint8_t>(id_arg.value()) : std::nullopt;
 
@@ -206,30 +226,124 @@ void web_server::handle_sensor_stats(esp32::http_request &request)
         return;
     }
 
+    auto since_arg_num = since_arg.has_value() ? esp32::string::parse_number<uint32_t>(since_arg.value()) : std::optional<uint32_t>(0);
+
+    if (!since_arg_num.has_value())
+    {
+        log_and_send_error(request, HTTPD_400_BAD_REQUEST, "since is invalid");
+        return;
+    }
+
+    // points downsamples to that many points, since is then an entry sequence rather than a point index
+    auto points_arg_num = points_arg.has_value() ? esp32::string::parse_number<uint16_t>(points_arg.value()) : std::optional<uint16_t>(0);
+
+    if (!points_arg_num.has_value() || (points_arg_num.value() && points_arg_num.value() < 3))
+    {
+        log_and_send_error(request, HTTPD_400_BAD_REQUEST, "points is invalid");
+        return;
+    }
+
     const auto id = static_cast<sensor_id_index>(id_arg_num.value());
-    const auto &sensor_detail_info = ui_interface_.get_sensor_detail_info(id);
+    const auto &sensor_detail_info = ui_interface_.get_sensor_detail_info(id, since_arg_num.value(), points_arg_num.value());
 
-    BasicJsonDocument<esp32::psram::json_allocator> json_document(8 * 1024);
+    const auto accept = request.get_header(AcceptHeader);
+    if (accept.has_value() && (accept.value().find(binary_media_type) != std::string::npos))
+    {
+        send_history_binary_response(request, id, sensor_detail_info);
+        return;
+    }
+
+    // streamed, the history can be of any length
+    esp32::json_stream_writer json(request, js_media_type);
+    json.begin_object();
 
-    auto stats_json = json_document.createNestedObject("stats");
+    json.member("first", sensor_detail_info.first);
+    json.member("start", sensor_detail_info.start);
+    json.member("cursor", sensor_detail_info.cursor);
+    json.member("interval", sensor_detail_info.interval);
+    json.member("age", sensor_detail_info.age);
 
+    json.begin_object("stats");
     if (sensor_detail_info.stat.has_value())
     {
         auto &&stats = sensor_detail_info.stat.value();
-        stats_json["max"].set(stats.max);
-        stats_json["min"].set(stats.min);
-        stats_json["mean"].set(stats.mean);
+        json.member("max", stats.max);
+        json.member("min", stats.min);
+        json.member("mean", stats.mean);
+        json.member("p50", stats.p50);
+        json.member("p90", stats.p90);
+        json.member("p99", stats.p99);
     }
     else
     {
-        stats_json["max"].set(nullptr);
-        stats_json["min"].set(nullptr);
-        stats_json["mean"].set(nullptr);
+        for (auto &&name : {"max", "min", "mean", "p50", "p90", "p99"})
+        {
+            json.member(name, nullptr);
+        }
     }
+    json.end_object();
 
-    json_document["history"].set(sensor_detail_info.history);
+    // a gap converts to NAN, written as null
+    json.begin_array("history");
+    for (auto &&value : sensor_detail_info.history)
+    {
+        json.value(sensor_history::to_value(value));
+    }
+    json.end_array();
+
+    if (!sensor_detail_info.positions.empty())
+    {
+        json.begin_array("positions");
+        for (auto &&position : sensor_detail_info.positions)
+        {
+            json.value(position);
+        }
+        json.end_array();
+    }
+
+    json.end_object();
+    json.end();
+}
+
+void web_server::send_history_binary_response(esp32::http_request &request, sensor_id_index id,
+                                              const sensor_history::sensor_history_snapshot &sensor_detail_info)
+{
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "binary history is sent in host byte order");
+
+    const auto &history = sensor_detail_info.history;
 
-    send_json_response(request, json_document);
+    history_binary_header header{};
+    std::copy(history_binary_magic.begin(), history_binary_magic.end(), header.magic);
+    header.version = history_binary_version;
+    header.sensor_id = static_cast<uint8_t>(id);
+    header.exponent = sensor_history::value_exponent;
+    header.flags = sensor_detail_info.positions.empty() ? 0 : history_binary_has_positions;
+    header.count = history.size();
+    header.first = sensor_detail_info.first;
+    header.start = sensor_detail_info.start;
+    header.cursor = sensor_detail_info.cursor;
+    header.interval = sensor_detail_info.interval;
+    header.age = std::min<uint64_t>(sensor_detail_info.age, std::numeric_limits<uint32_t>::max());
+    if (sensor_detail_info.stat.has_value())
+    {
+        auto &&stats = sensor_detail_info.stat.value();
+        header.mean = sensor_history::from_value(stats.mean);
+        header.min = sensor_history::from_value(stats.min);
+        header.max = sensor_history::from_value(stats.max);
+        header.p50 = sensor_history::from_value(stats.p50);
+        header.p90 = sensor_history::from_value(stats.p90);
+        header.p99 = sensor_history::from_value(stats.p99);
+    }
+    else
+    {
+        header.mean = header.min = header.max = header.p50 = header.p90 = header.p99 = sensor_history::gap_value;
+    }
+
+    esp32::chunked_response response(request, binary_media_type);
+    response.send_chunk(&header, sizeof(header));
+    response.send_chunk(history.data(), history.size() * sizeof(sensor_history::value_t));
+    response.send_chunk(sensor_detail_info.positions.data(), sensor_detail_info.positions.size() * sizeof(uint32_t));
+    response.end();
 }
 
 void web_server::handle_config_get(esp32::http_request &request)
@@ -247,23 +361,48 @@ void web_server::handle_config_get(esp32::http_request &request)
 bool web_server::is_authenticated(esp32::http_request &request)
 {
     ESP_LOGV(WEBSERVER_TAG, "Checking if authenticated");
-    auto const cookie = request.get_header(CookieHeader);
-    if (cookie.has_value())
+    const auto cookie = request.get_header(CookieHeader);
+    const auto token = get_session_token(cookie);
+    if (token.has_value() && sessions_.validate(token.value(), request.client_ip_address()))
     {
-        ESP_LOGV(WEBSERVER_TAG, "Found cookie:%s", cookie->c_str());
-
-        const std::string token = create_hash(config_.get_web_user_credentials(), request.client_ip_address());
-
-        if (cookie == (std::string(AuthCookieName) + token))
-        {
-            ESP_LOGV(WEBSERVER_TAG, "Authentication Successful");
-            return true;
-        }
+        ESP_LOGV(WEBSERVER_TAG, "Authentication Successful");
+        return true;
     }
     ESP_LOGD(WEBSERVER_TAG, "Authentication Failed");
     return false;
 }
 
+// value of the session cookie, other cookies in the header are skipped
+std::optional<std::string_view> web_server::get_session_token(const std::optional<std::string> &cookie)
+{
+    if (!cookie.has_value())
+    {
+        return std::nullopt;
+    }
+
+    const std::string_view cookies{cookie.value()};
+    const std::string_view name{AuthCookieName};
+    auto start = cookies.find(name);
+    while (start != std::string_view::npos && start != 0 && cookies[start - 1] != ' ' && cookies[start - 1] != ';')
+    {
+        start = cookies.find(name, start + 1);
+    }
+
+    if (start == std::string_view::npos)
+    {
+        return std::nullopt;
+    }
+
+    auto token = cookies.substr(start + name.size());
+    return token.substr(0, token.find(';'));
+}
+
+// Set-Cookie value, must outlive the response as headers are sent by pointer
+std::string web_server::get_session_cookie(const std::string &token)
+{
+    return std::string(AuthCookieName) + token + "; Path=/; HttpOnly";
+}
+
 void web_server::handle_login(esp32::http_request &request)
 {
     ESP_LOGI(WEBSERVER_TAG, "Handle login");
@@ -284,10 +423,7 @@ void web_server::handle_login(esp32::http_request &request)
         {
             ESP_LOGI(WEBSERVER_TAG, "User/Password correct");
 
-            const std::string token = create_hash(current_credentials, request.client_ip_address());
-            ESP_LOGD(WEBSERVER_TAG, "Token:%s", token.c_str());
-
-            const auto cookie_header = std::string(AuthCookieName) + token;
+            const auto cookie_header = get_session_cookie(sessions_.create(request.client_ip_address()));
             response.add_header("Set-Cookie", cookie_header.c_str());
 
             response.redirect("/");
@@ -308,8 +444,15 @@ void web_server::handle_login(esp32::http_request &request)
 void web_server::handle_logout(esp32::http_request &request)
 {
     ESP_LOGI(WEBSERVER_TAG, "Disconnection");
+    const auto cookie = request.get_header(CookieHeader);
+    const auto token = get_session_token(cookie);
+    if (token.has_value())
+    {
+        sessions_.remove(token.value());
+    }
+
     esp32::http_response response(request);
-    response.add_header("Set-Cookie", "ESPSESSIONID=0");
+    response.add_header("Set-Cookie", "ESPSESSIONID=0; Path=/");
     response.redirect("/login.html?msg=User disconnected");
 }
 
@@ -329,9 +472,16 @@ void web_server::handle_web_login_update(esp32::http_request &request)
     if (user_name.has_value() && password.has_value())
     {
         ESP_LOGI(WEBSERVER_TAG, "Updating web username/password");
-        config_.set_web_user_credentials(credentials(user_name.value(), password.value()));
-        config_.save();
-        redirect_to_root(request);
+        auto transaction = config_.begin_transaction();
+        transaction.set_web_user_credentials(credentials(user_name.value(), password.value()));
+        transaction.commit();
+
+        // sessions of the old credentials end, this client gets a new one
+        sessions_.clear();
+        esp32::http_response response(request);
+        const auto cookie_header = get_session_cookie(sessions_.create(request.client_ip_address()));
+        response.add_header("Set-Cookie", cookie_header.c_str());
+        response.redirect("/");
     }
     else
     {
@@ -351,12 +501,12 @@ void web_server::handle_other_settings_update(esp32::http_request &request)
     const auto arguments = request.get_form_url_encoded_arguments({"hostName"});
     auto &&host_name = arguments[0];
 
+    auto transaction = config_.begin_transaction();
     if (host_name.has_value())
     {
-        config_.set_host_name(host_name.value());
+        transaction.set_host_name(host_name.value());
     }
-
-    config_.save();
+    transaction.commit();
 
     redirect_to_root(request);
 }
@@ -466,7 +616,7 @@ void web_server::notify_sensor_change(sensor_id_index id)
 {
     try
     {
-        if (events.connection_count())
+        if (events.is_active())
         {
             queue_work<web_server, sensor_id_index, &web_server::send_sensor_data>(id);
         }
@@ -483,16 +633,29 @@ void web_server::send_sensor_data(sensor_id_index id)
     const auto &sensor = ui_interface_.get_sensor(id);
     const auto value = sensor.get_value();
 
-    BasicJsonDocument<esp32::psram::json_allocator> json_document(128);
+    esp32::json_arena_document json_document;
 
     auto &&definition = get_sensor_definition(id);
     json_document["value"] = value;
     json_document["id"] = static_cast<uint8_t>(id);
     json_document["level"] = static_cast<uint64_t>(definition.calculate_level(value));
 
-    esp32::psram::string json;
-    serializeJson(json_document, json);
-    events.try_send(json.c_str(), "sensor", esp32::millis(), 0);
+    std::array<char, 128> json;
+    if (serializeJson(json_document, json.data(), json.size()) >= json.size() - 1)
+    {
+        ESP_LOGW(WEBSERVER_TAG, "Sensor event for %s too long", get_sensor_name(id).data());
+        return;
+    }
+
+    // only the latest value of a sensor is kept for a slow client
+    events.try_send(json.data(), "sensor", 0, static_cast<uint32_t>(id) + 1);
+}
+
+void web_server::on_housekeeping()
+{
+    // retry queued events of slow clients
+    events.flush();
+    logging.flush();
 }
 
 void web_server::handle_events(esp32::http_request &request)
@@ -504,7 +667,11 @@ void web_server::handle_events(esp32::http_request &request)
         return;
     }
 
-    events.add_request(request);
+    // a reconnecting client only gets the events it missed
+    if (events.add_request(request))
+    {
+        return;
+    }
 
     ESP_LOGI(WEBSERVER_TAG, "Events client first time");
 
@@ -524,8 +691,10 @@ void web_server::handle_logging(esp32::http_request &request)
         return;
     }
 
-    logging.add_request(request);
-    ESP_LOGI(WEBSERVER_TAG, "Logging first time");
+    if (!logging.add_request(request))
+    {
+        ESP_LOGI(WEBSERVER_TAG, "Logging first time");
+    }
 }
 
 void web_server::handle_web_logging_start(esp32::http_request &request)
@@ -630,7 +799,7 @@ void web_server::received_log_data(std::unique_ptr<std::string> log)
 {
     try
     {
-        if (logging.connection_count())
+        if (logging.is_active())
         {
             queue_work<web_server, std::unique_ptr<std::string>, &web_server::send_log_data>(std::move(log));
         }
@@ -643,7 +812,7 @@ void web_server::received_log_data(std::unique_ptr<std::string> log)
 
 void web_server::send_log_data(std::unique_ptr<std::string> log)
 {
-    logging.try_send((*log).c_str(), "logs", esp32::millis(), 0);
+    logging.try_send((*log).c_str(), "logs");
 }
 
 void web_server::on_set_logging_level(esp32::http_request &request)
@@ -714,29 +883,17 @@ void web_server::handle_homekit_info_get(esp32::http_request &request)
 
 void web_server::send_table_response(esp32::http_request &request, ui_interface::information_type type)
 {
-    BasicJsonDocument<esp32::psram::json_allocator> json_document(2048);
-    JsonArray arr = json_document.to<JsonArray>();
-
     const auto data = ui_interface_.get_information_table(type);
 
+    esp32::json_stream_writer json(request, js_media_type);
+    json.begin_array();
     for (auto &&[key, value] : data)
     {
-        add_key_value_object(arr, key, value);
+        json.begin_object();
+        json.member("key", key);
+        json.member("value", value);
+        json.end_object();
     }
-
-    send_json_response(request, json_document);
-}
-
-void web_server::send_json_response(esp32::http_request &request, const BasicJsonDocument<esp32::psram::json_allocator> &json_document)
-{
-    if (json_document.overflowed())
-    {
-        log_and_send_error(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Json document overflowed");
-        return;
-    }
-
-    esp32::psram::string json;
-    json.reserve(json_document.memoryUsage() * 2);
-    serializeJson(json_document, json);
-    esp32::array_response::send_response(request, json, js_media_type);
+    json.end_array();
+    json.end();
 }
\ No newline at end of file
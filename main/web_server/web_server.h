@@ -8,6 +8,7 @@
 #include "util/async_web_server/http_server.h"
 #include "util/default_event.h"
 #include "util/singleton.h"
+#include "web_server/session_table.h"
 #include <vector>
 
 class config;
@@ -19,6 +20,9 @@ class web_server final : esp32::http_server, public esp32::singleton<web_server>
     void begin() override;
     static web_server instance;
 
+  protected:
+    void on_housekeeping() override;
+
   private:
     web_server(config &config, ui_interface &ui_interface, logger &logger)
         : esp32::http_server(80), config_(config), ui_interface_(ui_interface), logger_(logger)
@@ -30,6 +34,7 @@ class web_server final : esp32::http_server, public esp32::singleton<web_server>
     config &config_;
     ui_interface &ui_interface_;
     logger &logger_;
+    session_table sessions_;
 
     template <const uint8_t data[], const auto len, const char *sha256> void handle_array_page_with_auth(esp32::http_request &request);
 
@@ -53,6 +58,8 @@ class web_server final : esp32::http_server, public esp32::singleton<web_server>
 
     // // helpers
     bool is_authenticated(esp32::http_request &request);
+    static std::optional<std::string_view> get_session_token(const std::optional<std::string> &cookie);
+    static std::string get_session_cookie(const std::string &token);
 
     bool check_authenticated(esp32::http_request &request);
     void redirect_to_root(esp32::http_request &request);
@@ -63,8 +70,6 @@ class web_server final : esp32::http_server, public esp32::singleton<web_server>
 
     static const char *get_content_type(const std::string &extension);
 
-    template <class Array, class K, class T> static void add_key_value_object(Array &array, const K &key, const T &value);
-
     static void log_and_send_error(const esp32::http_request &request, httpd_err_code_t code, const std::string &error);
     static void send_empty_200(const esp32::http_request &request);
     static std::string get_file_sha256(const char *filename);
@@ -84,7 +89,8 @@ class web_server final : esp32::http_server, public esp32::singleton<web_server>
 
     void send_table_response(esp32::http_request &request, ui_interface::information_type type);
 
-    void send_json_response(esp32::http_request &request, const BasicJsonDocument<esp32::psram::json_allocator> &document);
+    void send_history_binary_response(esp32::http_request &request, sensor_id_index id,
+                                      const sensor_history::sensor_history_snapshot &sensor_detail_info);
 
     esp32::event_source events;
     esp32::event_source logging;
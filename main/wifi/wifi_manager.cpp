@@ -74,7 +74,7 @@ void wifi_manager::wifi_task_ftn()
         do
         {
             // not connected or ssid changed
-            if (!connected_to_ap_ || (get_ssid() != config_.get_wifi_credentials().get_user_name()))
+            if (!connected_to_ap_ || (get_ssid() != config_.get_snapshot()->wifi_credentials.get_user_name()))
             {
                 disconnect();
                 connected_to_ap_ = connect_saved_wifi();
@@ -124,8 +124,9 @@ void wifi_manager::wifi_task_ftn()
                     if (!ssid.empty())
                     {
                         ESP_LOGI(WIFI_TAG, "Updating wifi ssid/password");
-                        config_.set_wifi_credentials(credentials(ssid, wifi_enroll_instance->get_password()));
-                        config_.save();
+                        auto transaction = config_.begin_transaction();
+                        transaction.set_wifi_credentials(credentials(ssid, wifi_enroll_instance->get_password()));
+                        transaction.commit();
                     }
                     else
                     {